@@ -0,0 +1,94 @@
+#!/bin/sh
+#
+# bench.sh - Builds mdriver once for every configuration of mm.c listed
+# below, runs each build on every trace with repeated timing trials (and
+# libc malloc once, with the first build), and collects the results in
+# <dir>/results.csv and <dir>/results.json, a JSON array with one object
+# per configuration and trace (see writeresults in mdriver.c).
+#
+# usage: bench.sh [-k] [-n <trials>] [-o <dir>] [-c <cflags>] <trace>...
+#   (or make bench TRACES="..." TRIALS=<n> BENCH_DIR=<dir>)
+#
+# With -k, mdriver also checks the heap with mm_check after every request
+# of its validity run (mdriver -c), which the timings don't include.
+# The traces are read relative to the current directory. The latencies
+# are only measured on x86, where mdriver reads the cycle counter.
+#
+
+trials=5
+dir=bench
+cflags="-Wall -O2"
+check=
+
+# name and flags of every configuration: placement policy, free block
+# index and link width, then the front-ends, arenas, realloc slack,
+# statistics and the backing of the heap
+configs="
+list-best
+list-first       -DMM_PLACEMENT=MM_PLACE_FIRST
+list-next        -DMM_PLACEMENT=MM_PLACE_NEXT
+list-good        -DMM_PLACEMENT=MM_PLACE_GOOD
+list-best-tags   -DMM_BOUNDARY_TAGS=1
+list-best-32     -DMM_COMPACT_LINKS=1
+list-packed      -DMM_PACKED_INDEX=1
+addr-tree-best   -DMM_ADDR_TREE=1
+addr-tree-first  -DMM_ADDR_TREE=1 -DMM_PLACEMENT=MM_PLACE_FIRST
+size-tree        -DMM_SIZE_TREE=1
+both-trees       -DMM_ADDR_TREE=1 -DMM_SIZE_TREE=1
+tlsf             -DMM_TLSF=1
+tlsf-32          -DMM_TLSF=1 -DMM_COMPACT_LINKS=1
+slabs            -DMM_SLABS=1
+quick-cache      -DMM_QUICK_CACHE=1
+deferred-free    -DMM_DEFERRED_FREE=1
+arenas           -DMM_ARENAS=4
+arenas-remote    -DMM_ARENAS=4 -DMM_REMOTE_FREE=1
+arenas-numa      -DMM_ARENAS=4 -DMEM_NUMA=1
+realloc-slack    -DMM_REALLOC_SLACK=2
+stats            -DMM_STATS=1
+hugepages        -DMEM_HUGEPAGES=1
+"
+
+sources="mdriver.c mm.c memlib.c fsecs.c fcyc.c clock.c ftimer.c fperf.c"
+
+while getopts "kn:o:c:" opt; do
+    case $opt in
+    k) check=-c ;;
+    n) trials=$OPTARG ;;
+    o) dir=$OPTARG ;;
+    c) cflags=$OPTARG ;;
+    *) echo "usage: $0 [-k] [-n <trials>] [-o <dir>] [-c <cflags>] <trace>..." >&2; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+if [ $# -eq 0 ]; then
+    echo "usage: $0 [-k] [-n <trials>] [-o <dir>] [-c <cflags>] <trace>..." >&2
+    exit 1
+fi
+
+case $(uname -m) in
+x86_64|i?86) latency=-L ;;
+*) latency= ;;
+esac
+
+mkdir -p "$dir" || exit 1
+rm -f "$dir/results.csv" "$dir/results.jsonl" "$dir/results.json"
+
+libc=-l
+echo "$configs" | while read -r name flags; do
+    [ -z "$name" ] && continue
+    echo "building $name"
+    rm -f "$dir/$name.log"
+    ${CC:-gcc} $cflags $flags -o "$dir/mdriver-$name" $sources -lpthread -lm || exit 1
+    for trace in "$@"; do
+	echo "  $trace"
+	"$dir/mdriver-$name" -a $libc $latency $check -n "$trials" -N "$name" \
+	    -C "$dir/results.csv" -J "$dir/results.jsonl" -f "$trace" >> "$dir/$name.log" 2>&1 ||
+	    echo "  mdriver failed, see $dir/$name.log"
+    done
+    libc=
+done || exit 1
+
+# the JSON Lines file becomes a single array
+sed '1s/^/[/; $!s/$/,/; $s/$/]/' "$dir/results.jsonl" > "$dir/results.json" &&
+    rm -f "$dir/results.jsonl"
+echo "results in $dir/results.csv and $dir/results.json"
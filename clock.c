@@ -16,14 +16,15 @@
 /******************************************************* 
  * Machine dependent functions 
  *
- * Note: the constants __i386__ and  __alpha
+ * Note: the constants __i386__, __x86_64__ and  __alpha
  * are set by GCC when it calls the C preprocessor
  * You can verify this for yourself using gcc -v.
  *******************************************************/
 
-#if defined(__i386__)  
+#if defined(__i386__) || defined(__x86_64__)
 /*******************************************************
  * Pentium versions of start_counter() and get_counter()
+ * (rdtsc behaves the same in 64 bits mode)
  *******************************************************/
 
 
@@ -108,6 +109,12 @@ static unsigned int counterRoutine[] =
 /* Cast the above instructions into a function. */
 static unsigned int (*counter)(void)= (void *)counterRoutine;
 
+/* Only the low order bits can be read from user programs */
+void access_counter(unsigned *hi, unsigned *lo)
+{
+    *hi = 0;
+    *lo = counter();
+}
 
 void start_counter()
 {
@@ -143,6 +150,13 @@ double get_counter()
  * haven't provided a Sparc version here.
  ***************************************************************/
 
+void access_counter(unsigned *hi, unsigned *lo)
+{
+    printf("ERROR: You are trying to use an access_counter routine in clock.c\n");
+    printf("that has not been implemented yet on this platform.\n");
+    exit(1);
+}
+
 void start_counter()
 {
     printf("ERROR: You are trying to use a start_counter routine in clock.c\n");
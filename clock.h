@@ -1,5 +1,8 @@
 /* Routines for using cycle counter */
 
+/* Set *hi and *lo to the high and low order bits of the cycle counter */
+void access_counter(unsigned *hi, unsigned *lo);
+
 /* Start the counter */
 void start_counter();
 
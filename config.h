@@ -58,9 +58,270 @@
 #define ALIGNMENT 8  
 
 /* 
- * Maximum heap size in bytes 
+ * Default maximum heap size in bytes. memlib takes another one at run
+ * time from mem_set_max_heap (mdriver -H) or from the MEM_MAX_HEAP
+ * environment variable (e.g. MEM_MAX_HEAP=8G).
  */
+#ifndef MAX_HEAP
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
+#endif
+
+/*
+ * Set MEM_MMAP to "1" to have memlib reserve the heap with mmap and
+ * make it accessible only as it grows (and give shrunk parts back),
+ * instead of allocating the whole heap with malloc. Accesses beyond
+ * the brk then fault.
+ */
+#ifndef MEM_MMAP
+#define MEM_MMAP 1
+#endif
+
+/*
+ * Set MEM_HUGEPAGES to "1" (with MEM_MMAP) to back the heap with pages
+ * of MEM_HUGEPAGE_SIZE bytes, to save TLB misses on large heaps: memlib
+ * reserves it in hugetlbfs pages (MAP_HUGETLB) if the pool (see
+ * /proc/sys/vm/nr_hugepages) has enough for the whole ceiling, or else
+ * aligns it on a huge page and asks for transparent huge pages
+ * (madvise(MADV_HUGEPAGE)), or else falls back to normal pages. The
+ * heap then grows by whole huge pages.
+ */
+#ifndef MEM_HUGEPAGES
+#define MEM_HUGEPAGES 0
+#endif
+#ifndef MEM_HUGEPAGE_SIZE
+#define MEM_HUGEPAGE_SIZE (2*1024*1024)
+#endif
+
+/*
+ * Set MEM_NUMA to "1" (with MEM_MMAP) to spread the segments of the
+ * heap (one per arena, see MM_ARENAS) over the NUMA nodes the process
+ * may use, in round robin, each bound to its node with mbind(MPOL_BIND).
+ * mm.c then binds every thread to an arena of the node it first
+ * allocates on. Without NUMA support, there is a single node.
+ */
+#ifndef MEM_NUMA
+#define MEM_NUMA 0
+#endif
+
+/*
+ * Free block index used by mm.c. By default the free blocks are kept in
+ * a single address-ordered list searched with best fit. Set MM_TLSF to
+ * "1" to use a two-level segregated fit instead: constant time malloc
+ * and free, at the price of a good fit instead of the best one. Can
+ * also be set from the make command line (-DMM_TLSF=1).
+ */
+#ifndef MM_TLSF
+#define MM_TLSF 0
+#endif
+
+/*
+ * Set MM_ADDR_TREE to "1" to keep the address-ordered free blocks in a
+ * balanced tree (treap) instead of a list, so that free and coalescing
+ * are O(log n). Exclusive with MM_TLSF.
+ */
+#ifndef MM_ADDR_TREE
+#define MM_ADDR_TREE 0
+#endif
+
+/*
+ * Set MM_SIZE_TREE to "1" to find the best fit in O(log n) with a tree
+ * keyed by (size, address). On its own it replaces the list; together
+ * with MM_ADDR_TREE both trees are kept. Exclusive with MM_TLSF.
+ */
+#ifndef MM_SIZE_TREE
+#define MM_SIZE_TREE 0
+#endif
+
+/*
+ * Placement policy of the address-ordered list and tree (the size tree
+ * always finds the best fit, TLSF a good fit):
+ *  - MM_PLACE_BEST: the smallest free block large enough.
+ *  - MM_PLACE_FIRST: the first one in address order.
+ *  - MM_PLACE_NEXT: the first one after where the last search stopped.
+ *  - MM_PLACE_GOOD: best fit, but stopping after MM_GOOD_FIT_CANDIDATES
+ *    blocks large enough, or on a block larger than the request by at
+ *    most MM_GOOD_FIT_SLACK percent.
+ * It is compiled in: there is no choice at run time.
+ */
+#define MM_PLACE_BEST  0
+#define MM_PLACE_FIRST 1
+#define MM_PLACE_NEXT  2
+#define MM_PLACE_GOOD  3
+#ifndef MM_PLACEMENT
+#define MM_PLACEMENT MM_PLACE_BEST
+#endif
+#ifndef MM_GOOD_FIT_CANDIDATES
+#define MM_GOOD_FIT_CANDIDATES 8
+#endif
+#ifndef MM_GOOD_FIT_SLACK
+#define MM_GOOD_FIT_SLACK 5
+#endif
+
+/*
+ * Set MM_PACKED_INDEX to "1" to also keep the sizes and addresses of
+ * the free blocks of the list in two dense arrays, sorted by address,
+ * in mappings of their own (counted as used memory). Best fit is then
+ * a vectorized scan of the sizes instead of a walk of the list, and the
+ * predecessor of a block a binary search. List with best fit only.
+ */
+#ifndef MM_PACKED_INDEX
+#define MM_PACKED_INDEX 0
+#endif
+
+/*
+ * Set MM_BOUNDARY_TAGS to "1" to give free blocks a footer and a flag
+ * in the header of the next block with the address-ordered list or
+ * tree too, so that free finds the left neighbour in constant time.
+ * Allocated blocks still have no footer. TLSF and the size tree alone
+ * always use them.
+ */
+#ifndef MM_BOUNDARY_TAGS
+#define MM_BOUNDARY_TAGS 0
+#endif
+
+/*
+ * Set MM_COMPACT_LINKS to "1" to store the links of the free blocks as
+ * 32 bits offsets from the beginning of the heap instead of pointers:
+ * the smallest block goes from 24 bytes to 16 (with the list).
+ */
+#ifndef MM_COMPACT_LINKS
+#define MM_COMPACT_LINKS 0
+#endif
+
+/*
+ * Number of arenas. With 0, mm.c manages a single heap and is not
+ * thread safe. Otherwise the heap is split in MM_ARENAS segments, each
+ * managed by its own lock, and threads are spread over the arenas.
+ * Each arena gets 1 / MM_ARENAS of the maximum heap size, and a thread
+ * whose arena is full allocates in the others.
+ */
+#ifndef MM_ARENAS
+#define MM_ARENAS 0
+#endif
+
+/*
+ * Set MM_REMOTE_FREE to "1" (with MM_ARENAS) to free a block from a
+ * thread bound to another arena without taking its lock: the block is
+ * pushed with a compare and swap on a lock-free stack of the arena that
+ * owns it, which is drained (its blocks freed and coalesced) in one go
+ * when a malloc of that arena finds no fit or no slab, and in mm_trim.
+ */
+#ifndef MM_REMOTE_FREE
+#define MM_REMOTE_FREE 0
+#endif
+
+/*
+ * Set MM_SLABS to "1" to serve small requests (up to 64 bytes) from
+ * slabs: pages cut in objects of a single size class, with no header
+ * per object. Larger requests still go to the free block index.
+ */
+#ifndef MM_SLABS
+#define MM_SLABS 0
+#endif
+
+/*
+ * Header giving the size classes of the slabs: SLAB_MAX_OBJECT,
+ * SLAB_CLASSES and the tables slab_class_size and slab_class_of. It is
+ * generated from the request sizes of traces by mdriver -S, e.g.
+ * "mdriver -S 6,128 trace1.rep trace2.rep > my_classes.h", then built with
+ * -DMM_SLAB_CLASSES='"my_classes.h"'. The default one has a class for
+ * every multiple of the alignment up to 64 bytes.
+ */
+#ifndef MM_SLAB_CLASSES
+#define MM_SLAB_CLASSES "slab_classes.h"
+#endif
+
+/*
+ * Set MM_DEFERRED_FREE to a number of blocks to defer coalescing: a
+ * free block then stays allocated in a pending set of that many blocks,
+ * which is sorted and freed in one pass when full or before the heap
+ * grows. With 0, every free coalesces right away.
+ */
+#ifndef MM_DEFERRED_FREE
+#define MM_DEFERRED_FREE 0
+#endif
+
+/*
+ * Set MM_QUICK_CACHE to a number of blocks to keep up to that many
+ * recently freed blocks of each size up to 256 bytes in a LIFO cache,
+ * still allocated, so that the next malloc of the same size takes one
+ * back right away. A full size is flushed into the free blocks, and
+ * every size before the heap grows. With 0, there is no cache.
+ */
+#ifndef MM_QUICK_CACHE
+#define MM_QUICK_CACHE 0
+#endif
+
+/*
+ * Set MM_REALLOC_SLACK to a number of reallocs: once a block has grown
+ * that many times, a realloc that has to move it asks for half as much
+ * again, so that the next ones grow in place. The blocks that grew are
+ * remembered with the size really asked for in a table of
+ * MM_SLACK_BLOCKS entries indexed by address, and the slack is split
+ * off when one is evicted or shrinks, before the heap grows and in
+ * mm_trim. With 0, realloc asks for the exact size.
+ */
+#ifndef MM_REALLOC_SLACK
+#define MM_REALLOC_SLACK 0
+#endif
+#ifndef MM_SLACK_BLOCKS
+#define MM_SLACK_BLOCKS 64
+#endif
+
+/*
+ * Set MM_STATS to "1" to have mm.c keep counters (live and free bytes,
+ * free blocks, largest free block, blocks looked at per malloc,
+ * splits, coalesces, reallocs, sbrk calls) up to date as it runs, so
+ * that mm_stats() reads them without walking the heap.
+ */
+#ifndef MM_STATS
+#define MM_STATS 0
+#endif
+
+/*
+ * When a free block larger than MM_TRIM_THRESHOLD bytes ends the heap,
+ * mm.c gives it back to memlib but for MM_TRIM_PAD bytes, so that the
+ * heap has to grow again by the difference before the next trim. Set
+ * MM_TRIM_THRESHOLD to "0" to never trim but through mm_trim().
+ */
+#ifndef MM_TRIM_THRESHOLD
+#define MM_TRIM_THRESHOLD (128*1024)
+#endif
+#ifndef MM_TRIM_PAD
+#define MM_TRIM_PAD (64*1024)
+#endif
+
+/*
+ * When a free makes a free block of at least MM_MADVISE_PAGES pages,
+ * mm.c gives the pages inside it (past its header, links and footer)
+ * back to the system with madvise(MADV_DONTNEED), or MADV_FREE if
+ * MM_MADVISE_FREE is "1": the system then takes them only when it
+ * needs memory. Set MM_MADVISE_PAGES to "0" to keep every page.
+ */
+#ifndef MM_MADVISE_PAGES
+#define MM_MADVISE_PAGES 64
+#endif
+#ifndef MM_MADVISE_FREE
+#define MM_MADVISE_FREE 0
+#endif
+
+/*
+ * Requests of at least MM_MMAP_THRESHOLD bytes get a mapping of their
+ * own outside of the heap, which is unmapped when they are freed and
+ * resized with mremap. Set it to "0" to keep every block in the heap.
+ */
+#ifndef MM_MMAP_THRESHOLD
+#define MM_MMAP_THRESHOLD (1024*1024)
+#endif
+
+/*
+ * Set MM_SILENT to "1" to compile out the messages mm.c and memlib.c
+ * print when a request fails: they then only return NULL (or -1 with
+ * errno). libmm.so is built with it, as it runs inside other programs.
+ */
+#ifndef MM_SILENT
+#define MM_SILENT 0
+#endif
 
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
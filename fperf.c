@@ -0,0 +1,129 @@
+/*
+ * fperf.c - Count the hardware events of a function f with the
+ * performance counters of Linux (perf_event_open).
+ *
+ * Each event has a counter of its own, counting in user mode only for
+ * this thread. When the processor has fewer counters than events, the
+ * kernel multiplexes them and the counts are scaled by the fraction of
+ * the time each one was running. An event the processor or the system
+ * doesn't provide (e.g. in a virtual machine, or with a too high
+ * /proc/sys/kernel/perf_event_paranoid) is reported as -1.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "fperf.h"
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define CACHE_READ_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static struct {
+    char *name;
+    unsigned int type;
+    unsigned long long config;
+} events[FPERF_EVENTS] = {
+    {"instrs",    PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"cycles",    PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"L1d miss",  PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D)},
+    {"LLC miss",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"dTLB miss", PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB)},
+    {"br miss",   PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+static int fds[FPERF_EVENTS] = {-1, -1, -1, -1, -1, -1};
+#else
+static char *names[FPERF_EVENTS] =
+    {"instrs", "cycles", "L1d miss", "LLC miss", "dTLB miss", "br miss"};
+#endif
+
+extern int verbose; /* -v option in mdriver.c */
+
+/*
+ * init_fperf - open one disabled counter per event
+ */
+int init_fperf(void)
+{
+    int opened = 0;
+#ifdef __linux__
+    struct perf_event_attr attr;
+    int i;
+
+    for (i = 0; i < FPERF_EVENTS; i++) {
+	if (fds[i] >= 0) {
+	    opened++;
+	    continue;
+	}
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[i].type;
+	attr.config = events[i].config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	if (fds[i] >= 0)
+	    opened++;
+	else if (verbose > 1)
+	    printf("Can't count %s events.\n", events[i].name);
+    }
+#endif
+    if (verbose)
+	printf("Counting hardware events with perf_event_open (%d of %d available).\n",
+	       opened, FPERF_EVENTS);
+    return opened;
+}
+
+/*
+ * fperf_name - Return the short name of event i
+ */
+const char *fperf_name(int i)
+{
+#ifdef __linux__
+    return events[i].name;
+#else
+    return names[i];
+#endif
+}
+
+/*
+ * fperf - Count the events of f(argp). Return the average of n runs.
+ */
+void fperf(fperf_test_funct f, void *argp, int n, double *counts)
+{
+    int i;
+
+#ifdef __linux__
+    unsigned long long value[3]; /* count, time enabled, time running */
+
+    for (i = 0; i < FPERF_EVENTS; i++) {
+	if (fds[i] >= 0) {
+	    ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+	    ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+    }
+#endif
+    for (i = 0; i < n; i++)
+	f(argp);
+#ifdef __linux__
+    for (i = 0; i < FPERF_EVENTS; i++) {
+	if (fds[i] >= 0)
+	    ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+    }
+#endif
+    for (i = 0; i < FPERF_EVENTS; i++) {
+	counts[i] = -1;
+#ifdef __linux__
+	if (fds[i] < 0)
+	    continue;
+	if (read(fds[i], value, sizeof(value)) != sizeof(value) || value[2] == 0)
+	    continue;
+	counts[i] = (double)value[0] * ((double)value[1] / value[2]) / n;
+#endif
+    }
+}
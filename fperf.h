@@ -0,0 +1,26 @@
+/*
+ * fperf.h - prototypes for the routines in fperf.c that count the
+ *     hardware events (instructions, cache misses...) of a test function f
+ */
+
+/* The test function takes a generic pointer as input */
+typedef void (*fperf_test_funct)(void *);
+
+/* Events counted, in the order of the counts given by fperf */
+#define FPERF_INSTRUCTIONS  0
+#define FPERF_CYCLES        1
+#define FPERF_L1D_MISSES    2
+#define FPERF_LLC_MISSES    3
+#define FPERF_DTLB_MISSES   4
+#define FPERF_BRANCH_MISSES 5
+#define FPERF_EVENTS        6
+
+/* Open the counters. Return how many of them the system lets us use */
+int init_fperf(void);
+
+/* Short name of event i, for table headers */
+const char *fperf_name(int i);
+
+/* Count the events of f(argp): counts[i] gets the average count of
+   event i over n runs, or -1 if it can't be counted */
+void fperf(fperf_test_funct f, void *argp, int n, double *counts);
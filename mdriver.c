@@ -14,11 +14,20 @@
 #include <string.h>
 #include <assert.h>
 #include <float.h>
+#include <math.h>
 #include <time.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "fperf.h"
+#include "clock.h"
 #include "config.h"
 
 /**********************
@@ -31,35 +40,66 @@
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
+#define IS_ALIGNED(p)  ((((uintptr_t)(p)) % ALIGNMENT) == 0)
 
 /****************************** 
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/* 
+ * Records the extent of each block's payload. The ranges are the nodes
+ * of a treap: a binary search tree by lo, balanced as a heap on a 
+ * random priority.
+ */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    struct range_t *left;  /* ranges below lo */
+    struct range_t *right; /* ranges above lo */
+    long priority;         /* larger than the priorities of the children */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
+/* Types of requests */
+enum {ALLOC, FREE, REALLOC};
+
+/* 
+ * Characterizes a single trace operation (allocator request). Only
+ * fixed-width fields, since binary traces store these records as is.
+ */
 typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
+    int type;                         /* type of request */
     int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
+    uint64_t size;                    /* byte size of alloc/realloc request */
 } traceop_t;
 
+/* 
+ * A binary trace file is this header followed by num_ops traceop_t,
+ * in the byte order of the machine that wrote it (see write_trace). 
+ */
+#define BIN_MAGIC   "MLTB"
+#define BIN_VERSION 2
+typedef struct {
+    char magic[4];       /* BIN_MAGIC, without the trailing 0 */
+    int version;         /* BIN_VERSION */
+    uint64_t sugg_heapsize; /* the four numbers of the text header */
+    int num_ids;
+    int num_ops;
+    int weight;
+    int unused;          /* so that the ops that follow are aligned */
+} binheader_t;
+
 /* Holds the information for one trace file*/
 typedef struct {
-    int sugg_heapsize;   /* suggested heap size (unused) */
+    size_t sugg_heapsize; /* suggested heap size (unused) */
     int num_ids;         /* number of alloc/realloc ids */
     int num_ops;         /* number of distinct requests */
     int weight;          /* weight for this trace (unused) */
     traceop_t *ops;      /* array of requests */
+    void *map;           /* mapping of a binary trace, whose ops are used in place (NULL for text traces) */
+    size_t map_size;
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    size_t *block_usable;/* ... and of what mm_usable_size said they hold (-c) */
 } trace_t;
 
 /* 
@@ -72,17 +112,55 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+/* 
+ * Log-scale histogram of latencies in cycles: every power of 2 is
+ * split in LAT_SUB linear buckets, so that a bucket is at most 1/LAT_SUB
+ * wider than its values. Values below LAT_SUB have a bucket each.
+ */
+#define LAT_SUB_LOG2 3
+#define LAT_SUB      (1 << LAT_SUB_LOG2)
+#define LAT_BUCKETS  (64 * LAT_SUB)
+typedef struct {
+    unsigned long count[LAT_BUCKETS];
+    unsigned long n;     /* number of requests measured */
+    unsigned long max;   /* largest latency measured */
+} lathist_t;
+
+/* Throughput of a multi-threaded replay (-T), and of the same replay on a single thread */
+#define MAX_THREADS 64
+typedef struct {
+    int threads;                      /* number of threads */
+    double ops;                       /* requests done by all the threads */
+    double secs;                      /* from the first start to the last end */
+    double base_ops;                  /* the same replay on a single thread */
+    double base_secs;
+    double thread_ops[MAX_THREADS];   /* requests done by each thread... */
+    double thread_secs[MAX_THREADS];  /* ... and the time it took */
+} mtstats_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
     double ops;      /* number of ops (malloc/free/realloc) in the trace */
     int valid;       /* was the trace processed correctly by the allocator? */
-    double secs;     /* number of secs needed to run the trace */
+    double secs;     /* number of secs needed to run the trace (mean of the trials) */
+    double secs_sd;  /* and its standard deviation over the trials (-n) */
+    double kops;     /* throughput in Kops/s, mean of the trials... */
+    double kops_sd;  /* ... and standard deviation */
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
 
-    /* Note: secs and util are only defined if valid is true */
+ /* Latency histograms of the mm requests (malloc/free/realloc), with -L */
+    lathist_t *lat;  /* NULL if the latencies were not measured */
+
+    /* Multi-threaded replay of the trace, with -T */
+    mtstats_t *mt;   /* NULL if it was not replayed on several threads */
+
+    /* Hardware events of a run of the trace, with -P */
+    double *perf;    /* FPERF_EVENTS counts (-1 if not available), or NULL */
+
+    /* Note: secs, util and lat are only defined if valid is true */
 } stats_t; 
 
 /********************
@@ -90,6 +168,7 @@ typedef struct {
  *******************/
 int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
+static int check_heap = 0; /* If set, call mm_check after every request (-c) */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
 /* Directory where default tracefiles are found */
@@ -105,14 +184,16 @@ static char *default_tracefiles[] = {
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
-static int add_range(range_t **ranges, char *lo, int size, 
+/* these functions manipulate range trees */
+static int add_range(range_t **ranges, char *lo, size_t size, 
 		     int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static void map_trace(trace_t *trace, char *path);
+static void write_trace(trace_t *trace, char *path);
 static void free_trace(trace_t *trace);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
@@ -124,9 +205,26 @@ static void eval_libc_speed(void *ptr);
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
+static lathist_t *eval_mm_latency(trace_t *trace);
+static mtstats_t *eval_mm_threads(trace_t *trace, int threads, int independent);
+
+/* Counts the hardware events of a speed function, for libc or mm */
+static double *eval_perf(fperf_test_funct f, speed_t *params);
+
+/* Times a speed function over several trials */
+static void eval_speed(fsecs_test_funct f, speed_t *params, int trials, stats_t *stats);
+
+/* Solves for the slab size classes that waste the least on some traces */
+static void eval_size_classes(int classes, int max_object, int n, char **paths);
+
+/* These functions record and summarize latencies */
+static void lat_record(lathist_t *hist, unsigned long cycles);
+static unsigned long lat_percentile(lathist_t *hist, double p);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void writeresults(char *csvfile, char *jsonfile, char *config, char *allocator,
+			 int n, stats_t *stats, char **tracefiles);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -150,6 +248,17 @@ int main(int argc, char **argv)
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int latency = 0;     /* If set, measure the latency of each request (-L) */
+    int threads = 0;     /* If set, also replay on that many threads (-T) */
+    int independent = 0; /* If set, each thread replays the whole trace (-i) */
+    int perf = 0;        /* If set, count hardware events (-P) */
+    int trials = 1;      /* Timing trials of each trace (-n) */
+    char *csvfile = NULL;  /* If set, append the results to this CSV file (-C) */
+    char *jsonfile = NULL; /* If set, append them to this JSON Lines file (-J) */
+    char *config = NULL;   /* Name of the mm configuration in them (-N) */
+    int classes = 0;       /* If set, generate a table of that many slab size classes (-S) */
+    int max_object = 64;   /* for requests up to that size */
+    char *binfile = NULL;/* If set, convert the trace to this binary file (-B) */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,7 +267,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:B:T:H:C:J:N:n:S:hvVgalLiPc")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -178,12 +287,67 @@ int main(int argc, char **argv)
 	    if (tracedir[strlen(tracedir)-1] != '/') 
 		strcat(tracedir, "/"); /* path always ends with "/" */
 	    break;
+	case 'B': /* Convert the trace given with -f to a binary trace */
+	    binfile = optarg;
+	    break;
         case 'a': /* Don't check team structure */
             team_check = 0;
             break;
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'L': /* Measure the latency of each request */
+            latency = 1;
+            break;
+        case 'T': /* Replay on several threads */
+            threads = atoi(optarg);
+            if (threads < 1 || threads > MAX_THREADS) {
+                printf("ERROR: -T needs between 1 and %d threads\n", MAX_THREADS);
+                exit(1);
+            }
+#if !MM_ARENAS
+            printf("ERROR: -T needs mm.c to be built with MM_ARENAS, to be thread safe\n");
+            exit(1);
+#endif
+            break;
+        case 'H': /* Heap ceiling, parsed by memlib as MEM_MAX_HEAP */
+            setenv("MEM_MAX_HEAP", optarg, 1);
+            break;
+        case 'i': /* With -T, each thread replays the whole trace */
+            independent = 1;
+            break;
+        case 'P': /* Count hardware events with the performance counters */
+            perf = 1;
+            break;
+        case 'c': /* Check the heap after every request of the validity run */
+            check_heap = 1;
+            break;
+        case 'n': /* Number of timing trials */
+            trials = atoi(optarg);
+            if (trials < 1) {
+                printf("ERROR: -n needs at least 1 trial\n");
+                exit(1);
+            }
+            break;
+        case 'C': /* Append the results to a CSV file */
+            csvfile = optarg;
+            break;
+        case 'J': /* Append the results to a JSON Lines file */
+            jsonfile = optarg;
+            break;
+        case 'N': /* Name of the configuration in the CSV and JSON results */
+            config = optarg;
+            break;
+        case 'S': /* Generate slab size classes: <classes>[,<max object>] */
+            classes = atoi(optarg);
+            if (strchr(optarg, ',') != NULL)
+                max_object = atoi(strchr(optarg, ',') + 1);
+            if (classes < 1 || max_object < ALIGNMENT || max_object % ALIGNMENT != 0) {
+                printf("ERROR: -S needs a number of classes and a largest object, a multiple of %d\n",
+                       ALIGNMENT);
+                exit(1);
+            }
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -199,6 +363,47 @@ int main(int argc, char **argv)
         }
     }
 	
+    /*
+     * Convert a trace to the binary format, and do nothing else
+     */
+    if (binfile != NULL) {
+	if (num_tracefiles != 1) {
+	    printf("ERROR: -B needs the trace to convert, given with -f\n");
+	    exit(1);
+	}
+	trace = read_trace(tracedir, tracefiles[0]);
+	write_trace(trace, binfile);
+	free_trace(trace);
+	exit(0);
+    }
+
+    /*
+     * Generate a table of slab size classes from the request sizes of
+     * the traces (of -f, given as operands, or the default ones), and
+     * do nothing else
+     */
+    if (classes > 0) {
+	char **paths;
+	int count = 0;
+
+	if (tracefiles == NULL && optind == argc) {
+	    tracefiles = default_tracefiles;
+	    num_tracefiles = sizeof(default_tracefiles) / sizeof(char *) - 1;
+	}
+	if ((paths = (char **)calloc(num_tracefiles + argc - optind, sizeof(char *))) == NULL)
+	    unix_error("ERROR: calloc failed in main");
+	for (i = 0; i < num_tracefiles; i++) {
+	    if ((paths[count] = malloc(strlen(tracedir) + strlen(tracefiles[i]) + 1)) == NULL)
+		unix_error("ERROR: malloc failed in main");
+	    strcpy(paths[count], tracedir);
+	    strcat(paths[count++], tracefiles[i]);
+	}
+	for (i = optind; i < argc; i++)
+	    paths[count++] = argv[i];
+	eval_size_classes(classes, max_object, count, paths);
+	exit(0);
+    }
+
     /* 
      * Check and print team info 
      */
@@ -237,6 +442,8 @@ int main(int argc, char **argv)
 
     /* Initialize the timing package */
     init_fsecs();
+    if (perf)
+	init_fperf();
 
     /*
      * Optionally run and evaluate the libc malloc package 
@@ -261,7 +468,9 @@ int main(int argc, char **argv)
 		speed_params.trace = trace;
 		if (verbose > 1)
 		    printf("and performance.\n");
-		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+		eval_speed(eval_libc_speed, &speed_params, trials, &libc_stats[i]);
+		if (perf)
+		    libc_stats[i].perf = eval_perf(eval_libc_speed, &speed_params);
 	    }
 	    free_trace(trace);
 	}
@@ -271,6 +480,7 @@ int main(int argc, char **argv)
 	    printf("\nResults for libc malloc:\n");
 	    printresults(num_tracefiles, libc_stats);
 	}
+	writeresults(csvfile, jsonfile, "libc", "libc", num_tracefiles, libc_stats, tracefiles);
     }
 
     /*
@@ -302,17 +512,34 @@ int main(int argc, char **argv)
 	    speed_params.ranges = ranges;
 	    if (verbose > 1)
 		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    eval_speed(eval_mm_speed, &speed_params, trials, &mm_stats[i]);
+	    if (perf) {
+		if (verbose > 1)
+		    printf("Counting hardware events.\n");
+		mm_stats[i].perf = eval_perf(eval_mm_speed, &speed_params);
+	    }
+	    if (latency) {
+		if (verbose > 1)
+		    printf("Measuring the latency of every request.\n");
+		mm_stats[i].lat = eval_mm_latency(trace);
+	    }
+	    if (threads) {
+		if (verbose > 1)
+		    printf("Replaying on %d threads.\n", threads);
+		mm_stats[i].mt = eval_mm_threads(trace, threads, independent);
+	    }
 	}
 	free_trace(trace);
     }
 
     /* Display the mm results in a compact table */
     if (verbose) {
-	printf("\nResults for mm malloc:\n");
+	printf("\nResults for mm malloc (%s):\n", mm_placement);
 	printresults(num_tracefiles, mm_stats);
 	printf("\n");
     }
+    writeresults(csvfile, jsonfile, (config != NULL) ? config : (char *)mm_placement, "mm",
+		 num_tracefiles, mm_stats, tracefiles);
 
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
@@ -367,22 +594,74 @@ int main(int argc, char **argv)
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the range tree, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks. Since the 
+ * payloads in the tree never overlap, a new one overlaps some payload
+ * iff it overlaps the payload just before it or the one just after 
+ * it, so every operation is a descent of the tree: O(log n) expected.
  ****************************************************************/
 
+/*
+ * range_join - joins two treaps, all the ranges of left being below
+ *     the ones of right
+ */
+static range_t *range_join(range_t *left, range_t *right)
+{
+    if (left == NULL)
+	return right;
+    if (right == NULL)
+	return left;
+    if (left->priority > right->priority) {
+	left->right = range_join(left->right, right);
+	return left;
+    }
+    right->left = range_join(left, right->left);
+    return right;
+}
+
+/*
+ * range_insert - inserts the range p in the treap rooted at root, 
+ *     returns the new root
+ */
+static range_t *range_insert(range_t *root, range_t *p)
+{
+    range_t *child;
+
+    if (root == NULL)
+	return p;
+    if (p->lo < root->lo) {
+	child = range_insert(root->left, p);
+	root->left = child;
+	if (child->priority > root->priority) { /* rotate right */
+	    root->left = child->right;
+	    child->right = root;
+	    return child;
+	}
+    }
+    else {
+	child = range_insert(root->right, p);
+	root->right = child;
+	if (child->priority > root->priority) { /* rotate left */
+	    root->right = child->left;
+	    child->left = root;
+	    return child;
+	}
+    }
+    return root;
+}
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     we create a range struct for this block and add it to the range tree. 
  */
-static int add_range(range_t **ranges, char *lo, int size, 
+static int add_range(range_t **ranges, char *lo, size_t size, 
 		     int tracenum, int opnum)
 {
     char *hi = lo + size - 1;
-    range_t *p;
+    range_t *p, *pred, *succ;
     char msg[MAXLINE];
 
     assert(size > 0);
@@ -395,36 +674,54 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap, or in a
+       mapping of its own */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
+	 (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+	!mem_is_mapped(lo, hi)) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
-        }
+    /* 
+     * The payload must not overlap any other payloads: neither the 
+     * last one starting at or below lo, nor the first one above lo
+     */
+    pred = succ = NULL;
+    for (p = *ranges;  p != NULL; ) {
+	if (p->lo <= lo) {
+	    pred = p;
+	    p = p->right;
+	}
+	else {
+	    succ = p;
+	    p = p->left;
+	}
+    }
+    if (pred != NULL && pred->hi >= lo)
+	p = pred;
+    else if (succ != NULL && succ->lo <= hi)
+	p = succ;
+    if (p != NULL) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		lo, hi, p->lo, p->hi);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
     }
 
     /* 
      * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and adding it the range tree.
      */
     if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
 	unix_error("malloc error in add_range");
-    p->next = *ranges;
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    p->left = p->right = NULL;
+    p->priority = random();
+    *ranges = range_insert(*ranges, p);
     return 1;
 }
 
@@ -435,16 +732,12 @@ static void remove_range(range_t **ranges, char *lo)
 {
     range_t *p;
     range_t **prevpp = ranges;
-    int size;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
+    for (p = *ranges;  p != NULL && p->lo != lo; p = *prevpp)
+	prevpp = (lo < p->lo) ? &(p->left) : &(p->right);
+    if (p != NULL) {
+	*prevpp = range_join(p->left, p->right);
+	free(p);
     }
 }
 
@@ -453,12 +746,12 @@ static void remove_range(range_t **ranges, char *lo)
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
+    range_t *p = *ranges;
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
+    if (p != NULL) {
+	clear_ranges(&(p->left));
+	clear_ranges(&(p->right));
+	free(p);
     }
     *ranges = NULL;
 }
@@ -469,7 +762,8 @@ static void clear_ranges(range_t **ranges)
  *********************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * read_trace - read a trace file and store it in memory. Binary traces
+ *     (starting with BIN_MAGIC) are mapped instead, see map_trace.
  */
 static trace_t *read_trace(char *tracedir, char *filename)
 {
@@ -477,9 +771,11 @@ static trace_t *read_trace(char *tracedir, char *filename)
     trace_t *trace;
     char type[MAXLINE];
     char path[MAXLINE];
-    unsigned index, size;
+    unsigned index;
+    size_t size;
     unsigned max_index = 0;
     unsigned op_index;
+    char magic[sizeof(BIN_MAGIC) - 1];
 
     if (verbose > 1)
 	printf("Reading tracefile: %s\n", filename);
@@ -495,7 +791,18 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	sprintf(msg, "Could not open %s in read_trace", path);
 	unix_error(msg);
     }
-    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
+
+    /* Binary traces are used in place */
+    if (fread(magic, 1, sizeof(magic), tracefile) == sizeof(magic) &&
+	memcmp(magic, BIN_MAGIC, sizeof(magic)) == 0) {
+	fclose(tracefile);
+	map_trace(trace, path);
+	return trace;
+    }
+    rewind(tracefile);
+    trace->map = NULL;
+
+    fscanf(tracefile, "%zu", &(trace->sugg_heapsize)); /* not used */
     fscanf(tracefile, "%d", &(trace->num_ids));     
     fscanf(tracefile, "%d", &(trace->num_ops));     
     fscanf(tracefile, "%d", &(trace->weight));        /* not used */
@@ -514,6 +821,9 @@ static trace_t *read_trace(char *tracedir, char *filename)
     if ((trace->block_sizes = 
 	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
 	unix_error("malloc 4 failed in read_trace");
+    if ((trace->block_usable = 
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc 5 failed in read_trace");
     
     /* read every request line in the trace file */
     index = 0;
@@ -521,14 +831,14 @@ static trace_t *read_trace(char *tracedir, char *filename)
     while (fscanf(tracefile, "%s", type) != EOF) {
 	switch(type[0]) {
 	case 'a':
-	    fscanf(tracefile, "%u %u", &index, &size);
+	    fscanf(tracefile, "%u %zu", &index, &size);
 	    trace->ops[op_index].type = ALLOC;
 	    trace->ops[op_index].index = index;
 	    trace->ops[op_index].size = size;
 	    max_index = (index > max_index) ? index : max_index;
 	    break;
 	case 'r':
-	    fscanf(tracefile, "%u %u", &index, &size);
+	    fscanf(tracefile, "%u %zu", &index, &size);
 	    trace->ops[op_index].type = REALLOC;
 	    trace->ops[op_index].index = index;
 	    trace->ops[op_index].size = size;
@@ -555,14 +865,113 @@ static trace_t *read_trace(char *tracedir, char *filename)
 }
 
 /*
- * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ * map_trace - maps the binary trace file at path read-only and points
+ *     trace->ops into the mapping, so nothing is parsed or copied. The
+ *     ops are only checked, so that a bad file can't make us write
+ *     outside of the blocks arrays.
+ */
+static void map_trace(trace_t *trace, char *path)
+{
+    int fd;
+    struct stat st;
+    binheader_t *header;
+    int i;
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+	sprintf(msg, "Could not open %s in map_trace", path);
+	unix_error(msg);
+    }
+    if (fstat(fd, &st) < 0)
+	unix_error("fstat failed in map_trace");
+    if ((size_t)st.st_size < sizeof(binheader_t)) {
+	sprintf(msg, "Binary trace %s is truncated", path);
+	app_error(msg);
+    }
+    trace->map_size = st.st_size;
+    trace->map = mmap(NULL, trace->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (trace->map == MAP_FAILED)
+	unix_error("mmap failed in map_trace");
+    close(fd);
+
+    header = (binheader_t *)trace->map;
+    if (header->version != BIN_VERSION || header->num_ids < 0 ||
+	header->num_ops < 0) {
+	sprintf(msg, "Binary trace %s has a bad header", path);
+	app_error(msg);
+    }
+    if (trace->map_size != sizeof(binheader_t) + 
+	(size_t)header->num_ops * sizeof(traceop_t)) {
+	sprintf(msg, "Binary trace %s does not have %d requests", 
+		path, header->num_ops);
+	app_error(msg);
+    }
+    trace->sugg_heapsize = header->sugg_heapsize;
+    trace->num_ids = header->num_ids;
+    trace->num_ops = header->num_ops;
+    trace->weight = header->weight;
+    trace->ops = (traceop_t *)(header + 1);
+
+    for (i = 0; i < trace->num_ops; i++) {
+	if (trace->ops[i].type < ALLOC || trace->ops[i].type > REALLOC ||
+	    trace->ops[i].index < 0 || trace->ops[i].index >= trace->num_ids) {
+	    sprintf(msg, "Bogus request %d in binary trace %s", i, path);
+	    app_error(msg);
+	}
+    }
+
+    if ((trace->blocks = 
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	unix_error("malloc 3 failed in map_trace");
+    if ((trace->block_sizes = 
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc 4 failed in map_trace");
+    if ((trace->block_usable = 
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc 5 failed in map_trace");
+}
+
+/*
+ * write_trace - writes a trace in the binary format mapped by map_trace
+ */
+static void write_trace(trace_t *trace, char *path)
+{
+    FILE *binfile;
+    binheader_t header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BIN_MAGIC, sizeof(header.magic));
+    header.version = BIN_VERSION;
+    header.sugg_heapsize = trace->sugg_heapsize;
+    header.num_ids = trace->num_ids;
+    header.num_ops = trace->num_ops;
+    header.weight = trace->weight;
+
+    if ((binfile = fopen(path, "wb")) == NULL) {
+	sprintf(msg, "Could not open %s in write_trace", path);
+	unix_error(msg);
+    }
+    if (fwrite(&header, sizeof(header), 1, binfile) != 1 ||
+	fwrite(trace->ops, sizeof(traceop_t), trace->num_ops, binfile) !=
+	(size_t)trace->num_ops || fclose(binfile) != 0) {
+	sprintf(msg, "Could not write %s in write_trace", path);
+	unix_error(msg);
+    }
+}
+
+/*
+ * free_trace - Free the trace record and the four arrays it points
+ *              to, all of which were allocated in read_trace() (the
+ *              ops of a binary trace are unmapped instead).
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    if (trace->map != NULL)   /* free the four arrays... */
+	munmap(trace->map, trace->map_size);
+    else
+	free(trace->ops);
     free(trace->blocks);      
     free(trace->block_sizes);
+    free(trace->block_usable);
     free(trace);              /* and the trace record itself... */
 }
 
@@ -572,19 +981,53 @@ void free_trace(trace_t *trace)
  **********************************************************************/
 
 /*
- * eval_mm_valid - Check the mm malloc package for correctness
+ * fill_usable - With -c, fills the payload of block index up to the size
+ *     mm_usable_size gives for it, which the caller may use as its own.
+ *     Returns 0 if that size is smaller than the size asked for.
+ */
+static int fill_usable(trace_t *trace, int index, char *p, size_t size)
+{
+    size_t usable = mm_usable_size(p);
+
+    trace->block_usable[index] = usable;
+    if (usable < size)
+	return 0;
+    memset(p, index & 0xFF, usable);
+    return 1;
+}
+
+/*
+ * usable_intact - With -c, checks that the bytes filled by fill_usable
+ *     are still there, before block index is reallocated or freed
+ */
+static int usable_intact(trace_t *trace, int index)
+{
+    unsigned char *p = (unsigned char *)trace->blocks[index];
+    size_t j;
+
+    for (j = 0; j < trace->block_usable[index]; j++)
+	if (p[j] != (index & 0xFF))
+	    return 0;
+    return 1;
+}
+
+/*
+ * eval_mm_valid - Check the mm malloc package for correctness, and
+ *     with -c the consistency of its heap after every request, and that
+ *     the bytes mm_usable_size gives stay with their block
  */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) 
 {
-    int i, j;
+    int i;
+    size_t j;
     int index;
-    int size;
-    int oldsize;
+    size_t size;
+    size_t oldsize;
     char *newp;
     char *oldp;
     char *p;
     
-    /* Reset the heap and free any records in the range list */
+    /* Reset the heap and free any records in the range tree */
     mem_reset_brk();
     clear_ranges(ranges);
 
@@ -611,7 +1054,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    /* 
 	     * Test the range of the new block for correctness and add it 
-	     * to the range list if OK. The block must be  be aligned properly,
+	     * to the range tree if OK. The block must be  be aligned properly,
 	     * and must not overlap any currently allocated block. 
 	     */ 
 	    if (add_range(ranges, p, size, tracenum, i) == 0)
@@ -623,6 +1066,10 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	     * data was copied to the new block
 	     */
 	    memset(p, index & 0xFF, size);
+	    if (check_heap && !fill_usable(trace, index, p, size)) {
+		malloc_error(tracenum, i, "mm_usable_size is smaller than the size asked for.");
+		return 0;
+	    }
 
 	    /* Remember region */
 	    trace->blocks[index] = p;
@@ -630,6 +1077,10 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    break;
 
         case REALLOC: /* mm_realloc */
+	    if (check_heap && !usable_intact(trace, index)) {
+		malloc_error(tracenum, i, "the usable bytes of the block were overwritten.");
+		return 0;
+	    }
 	    
 	    /* Call the student's realloc */
 	    oldp = trace->blocks[index];
@@ -638,10 +1089,10 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 		return 0;
 	    }
 	    
-	    /* Remove the old region from the range list */
+	    /* Remove the old region from the range tree */
 	    remove_range(ranges, oldp);
 	    
-	    /* Check new block for correctness and add it to range list */
+	    /* Check new block for correctness and add it to range tree */
 	    if (add_range(ranges, newp, size, tracenum, i) == 0)
 		return 0;
 	    
@@ -653,13 +1104,17 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
 	      }
 	    }
 	    memset(newp, index & 0xFF, size);
+	    if (check_heap && !fill_usable(trace, index, newp, size)) {
+		malloc_error(tracenum, i, "mm_usable_size is smaller than the size asked for.");
+		return 0;
+	    }
 
 	    /* Remember region */
 	    trace->blocks[index] = newp;
@@ -668,7 +1123,12 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 
         case FREE: /* mm_free */
 	    
-	    /* Remove region from list and call student's free function */
+	    if (check_heap && !usable_intact(trace, index)) {
+		malloc_error(tracenum, i, "the usable bytes of the block were overwritten.");
+		return 0;
+	    }
+
+	    /* Remove region from tree and call student's free function */
 	    p = trace->blocks[index];
 	    remove_range(ranges, p);
 	    mm_free(p);
@@ -678,6 +1138,11 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
 
+	/* Have the package check its own heap */
+	if (check_heap && !mm_check()) {
+	    malloc_error(tracenum, i, "mm_check failed after this request.");
+	    return 0;
+	}
     }
 
     /* As far as we know, this is a valid malloc package */
@@ -689,19 +1154,20 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for 
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
- *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
+ *   largest size the heap reached while running the student's malloc 
+ *   package on the trace. mem_sbrk() lets the package decrement the 
+ *   brk pointer, so we use the peak recorded by memlib rather than 
+ *   the final size of the heap. The bytes mapped for huge blocks, at 
+ *   their peak, count as heap too. 
  *   
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 {   
     int i;
     int index;
-    int size, newsize, oldsize;
-    int max_total_size = 0;
-    int total_size = 0;
+    size_t size, newsize, oldsize;
+    size_t max_total_size = 0;
+    size_t total_size = 0;
     char *p;
     char *newp, *oldp;
 
@@ -774,7 +1240,8 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
         }
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / 
+	    (double)(mem_peak_heapsize() + mem_peak_mapped_bytes()));
 }
 
 
@@ -784,7 +1251,8 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index, size, newsize;
+    int i, index;
+    size_t size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
@@ -825,6 +1293,434 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/*
+ * eval_size_classes - Reads the traces of paths, makes the histogram of
+ *    the sizes of their requests of at most max_object bytes, and solves
+ *    (by dynamic programming over the sizes rounded up to the alignment)
+ *    for the table of classes sizes that wastes the fewest bytes between
+ *    the requests and their class, the largest class being max_object.
+ *    Prints it as a header for mm.c (see MM_SLAB_CLASSES in config.h)
+ *    on stdout, and the waste against evenly spaced classes on stderr.
+ */
+static void eval_size_classes(int classes, int max_object, int n, char **paths)
+{
+    int steps = max_object / ALIGNMENT; /* sizes a class can have */
+    double *count, *bytes;              /* requests and bytes requested of each size, summed up to it */
+    double *cost;                       /* cost[k * (steps+1) + b]: the least waste of sizes up to */
+    int *last;                          /* b with k+1 classes, the largest of them b, and the one before */
+    int *size;
+    double waste, even, total_bytes;
+    trace_t *trace;
+    int i, t, k, a, b, u;
+
+    if (classes > steps)
+	classes = steps;
+    count = (double *)calloc(steps + 1, sizeof(double));
+    bytes = (double *)calloc(steps + 1, sizeof(double));
+    cost = (double *)calloc((size_t)classes * (steps + 1), sizeof(double));
+    last = (int *)calloc((size_t)classes * (steps + 1), sizeof(int));
+    size = (int *)calloc(classes, sizeof(int));
+    if (count == NULL || bytes == NULL || cost == NULL || last == NULL || size == NULL)
+	unix_error("ERROR: calloc failed in eval_size_classes");
+
+    for (t = 0; t < n; t++) {
+	trace = read_trace("", paths[t]);
+	for (i = 0; i < trace->num_ops; i++) {
+	    if (trace->ops[i].type == FREE || trace->ops[i].size > max_object)
+		continue;
+	    u = (trace->ops[i].size + ALIGNMENT - 1) / ALIGNMENT;
+	    count[(u == 0) ? 1 : u] += 1;
+	    bytes[(u == 0) ? 1 : u] += trace->ops[i].size;
+	}
+	free_trace(trace);
+    }
+    for (u = 1; u <= steps; u++) {
+	count[u] += count[u - 1];
+	bytes[u] += bytes[u - 1];
+    }
+    total_bytes = bytes[steps];
+
+    /* waste of the sizes after a up to b, in a class of size b */
+#define WASTE(a, b) ((double)(b) * ALIGNMENT * (count[b] - count[a]) - (bytes[b] - bytes[a]))
+    for (b = 1; b <= steps; b++)
+	cost[b] = WASTE(0, b);
+    for (k = 1; k < classes; k++) {
+	for (b = k + 1; b <= steps; b++) {
+	    cost[k * (steps + 1) + b] = -1;
+	    for (a = k; a < b; a++) {
+		waste = cost[(k - 1) * (steps + 1) + a] + WASTE(a, b);
+		if (cost[k * (steps + 1) + b] < 0 || waste < cost[k * (steps + 1) + b]) {
+		    cost[k * (steps + 1) + b] = waste;
+		    last[k * (steps + 1) + b] = a;
+		}
+	    }
+	}
+    }
+    waste = cost[(classes - 1) * (steps + 1) + steps];
+    for (k = classes - 1, b = steps; k >= 0; k--) {
+	size[k] = b;
+	b = last[k * (steps + 1) + b];
+    }
+
+    /* the same number of classes, evenly spaced */
+    even = 0;
+    for (k = 0, a = 0; k < classes; k++) {
+	b = (k == classes - 1) ? steps : (int)((double)steps * (k + 1) / classes);
+	if (b > a) {
+	    even += WASTE(a, b);
+	    a = b;
+	}
+    }
+#undef WASTE
+
+    fprintf(stderr, "%.0f requests of at most %d bytes, %.0f bytes requested\n",
+	    count[steps], max_object, total_bytes);
+    fprintf(stderr, "waste with %d classes: %.0f bytes (%.2f%%), evenly spaced: %.0f bytes (%.2f%%)\n",
+	    classes, waste, (total_bytes > 0) ? 100.0 * waste / total_bytes : 0,
+	    even, (total_bytes > 0) ? 100.0 * even / total_bytes : 0);
+
+    printf("/*\n");
+    printf(" * Slab size classes, generated by mdriver -S %d,%d from the requests of\n",
+	   classes, max_object);
+    for (t = 0; t < n; t++)
+	printf(" *     %s\n", paths[t]);
+    printf(" * %.0f requests of at most %d bytes, %.2f%% of their bytes wasted.\n",
+	   count[steps], max_object, (total_bytes > 0) ? 100.0 * waste / total_bytes : 0);
+    printf(" * slab_class_of gives the class of a request from its size rounded up\n");
+    printf(" * to the alignment.\n");
+    printf(" */\n");
+    printf("#define SLAB_MAX_OBJECT     %d\n", max_object);
+    printf("#define SLAB_CLASSES        %d\n", classes);
+    printf("\n");
+    printf("static const size_t slab_class_size[SLAB_CLASSES] = {");
+    for (k = 0; k < classes; k++)
+	printf("%s%d", (k == 0) ? "" : ", ", size[k] * ALIGNMENT);
+    printf("};\n");
+    printf("static const unsigned char slab_class_of[SLAB_MAX_OBJECT / ALIGNMENT + 1] = {0");
+    for (u = 1, k = 0; u <= steps; u++) {
+	while (size[k] < u)
+	    k++;
+	printf(", %d", k);
+    }
+    printf("};\n");
+
+    free(count);
+    free(bytes);
+    free(cost);
+    free(last);
+    free(size);
+}
+
+/*
+ * eval_speed - Times the speed function f of libc or mm (see fsecs)
+ *    trials times, and sets the mean and the standard deviation of the
+ *    time and of the throughput in *stats
+ */
+static void eval_speed(fsecs_test_funct f, speed_t *params, int trials, stats_t *stats)
+{
+    double secs, kops;
+    double sum_secs = 0, sum_secs2 = 0, sum_kops = 0, sum_kops2 = 0;
+    int t;
+
+    for (t = 0; t < trials; t++) {
+	secs = fsecs(f, params);
+	kops = (stats->ops/1e3)/secs;
+	sum_secs += secs;
+	sum_secs2 += secs * secs;
+	sum_kops += kops;
+	sum_kops2 += kops * kops;
+    }
+    stats->secs = sum_secs / trials;
+    stats->kops = sum_kops / trials;
+    stats->secs_sd = stats->kops_sd = 0;
+    if (trials > 1) {
+	/* sample standard deviations, clamped against rounding errors */
+	secs = (sum_secs2 - sum_secs * stats->secs) / (trials - 1);
+	kops = (sum_kops2 - sum_kops * stats->kops) / (trials - 1);
+	stats->secs_sd = (secs > 0) ? sqrt(secs) : 0;
+	stats->kops_sd = (kops > 0) ? sqrt(kops) : 0;
+    }
+}
+
+/*
+ * eval_perf - Runs the speed function f of libc or mm a few more times
+ *    with the hardware performance counters on, and returns the average
+ *    count of every event (-1 for those that can't be counted).
+ */
+static double *eval_perf(fperf_test_funct f, speed_t *params)
+{
+    double *counts;
+
+    if ((counts = (double *)calloc(FPERF_EVENTS, sizeof(double))) == NULL)
+	unix_error("calloc in eval_perf failed");
+    fperf(f, params, 3, counts);
+    return counts;
+}
+
+/*
+ * eval_mm_latency - Runs the trace once more, reading the cycle counter
+ *    around every request, and returns one latency histogram per 
+ *    request type (indexed by ALLOC, FREE and REALLOC). The cost of 
+ *    reading the counter, measured beforehand, is subtracted.
+ */
+static lathist_t *eval_mm_latency(trace_t *trace)
+{
+    int i, index;
+    size_t size;
+    unsigned hi, lo;
+    unsigned long start, end, overhead, cycles;
+    char *p;
+    lathist_t *lat;
+
+    if ((lat = (lathist_t *)calloc(3, sizeof(lathist_t))) == NULL)
+	unix_error("calloc failed in eval_mm_latency");
+
+    /* The smallest of a few empty measurements is the overhead */
+    overhead = ~0UL;
+    for (i = 0; i < 100; i++) {
+	access_counter(&hi, &lo);
+	start = ((unsigned long)hi << 32) | lo;
+	access_counter(&hi, &lo);
+	end = ((unsigned long)hi << 32) | lo;
+	if (end - start < overhead)
+	    overhead = end - start;
+    }
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in eval_mm_latency");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	p = NULL;
+
+	access_counter(&hi, &lo);
+	start = ((unsigned long)hi << 32) | lo;
+        switch (trace->ops[i].type) {
+        case ALLOC: /* mm_malloc */
+            p = mm_malloc(size);
+            break;
+	case REALLOC: /* mm_realloc */
+            p = mm_realloc(trace->blocks[index], size);
+            break;
+        case FREE: /* mm_free */
+            mm_free(trace->blocks[index]);
+            break;
+	default:
+	    app_error("Nonexistent request type in eval_mm_latency");
+        }
+	access_counter(&hi, &lo);
+	end = ((unsigned long)hi << 32) | lo;
+
+	if (trace->ops[i].type != FREE) {
+	    if (p == NULL)
+		app_error("mm_malloc or mm_realloc error in eval_mm_latency");
+	    trace->blocks[index] = p;
+	}
+	cycles = end - start;
+	cycles = (cycles > overhead) ? cycles - overhead : 0;
+	lat_record(&lat[trace->ops[i].type], cycles);
+    }
+    return lat;
+}
+
+/*
+ * The following routines replay a trace on several threads at once (-T).
+ * Sharded, every block id belongs to a thread, which does its mallocs and
+ * reallocs; half of the blocks of each thread are freed by the next one.
+ * The requests of an id are still done in order: each request waits for
+ * the previous one of its id, which is always earlier in the trace, so
+ * the threads can't wait for each other in cycle. Independent, every 
+ * thread replays the whole trace on blocks of its own.
+ */
+
+/* Holds the params of one replay thread */
+typedef struct {
+    trace_t *trace;
+    int thread;                       /* number of the thread */
+    int threads;                      /* number of threads */
+    int independent;                  /* replay the whole trace */
+    char **blocks;                    /* blocks of the ids, shared unless independent */
+    int *rank;                        /* rank of each request among the ones of its id */
+    int *done;                        /* requests done for each id */
+    pthread_barrier_t *barrier;       /* for the threads to start together */
+    double start, end;                /* when the thread started and ended */
+    int ops;                          /* requests done by the thread */
+} replay_t;
+
+/*
+ * replay_owner - Returns the thread doing request i of the trace, when sharded
+ */
+static int replay_owner(trace_t *trace, int i, int threads)
+{
+    int index = trace->ops[i].index;
+    int owner = index % threads;
+
+    if (trace->ops[i].type == FREE)
+	owner = (owner + (index / threads) % 2) % threads;
+    return owner;
+}
+
+/*
+ * replay_now - Returns the time in seconds on a monotonic clock
+ */
+static double replay_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * replay_thread - Does the requests of one thread
+ */
+static void *replay_thread(void *ptr)
+{
+    replay_t *r = (replay_t *)ptr;
+    trace_t *trace = r->trace;
+    int i, index;
+    char *p;
+
+    pthread_barrier_wait(r->barrier);
+    r->start = replay_now();
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	if (!r->independent) {
+	    if (replay_owner(trace, i, r->threads) != r->thread)
+		continue;
+	    while (__atomic_load_n(&r->done[index], __ATOMIC_ACQUIRE) != r->rank[i])
+		sched_yield();
+	}
+
+        switch (trace->ops[i].type) {
+        case ALLOC: /* mm_malloc */
+            if ((p = mm_malloc(trace->ops[i].size)) == NULL)
+		app_error("mm_malloc error in replay_thread");
+            r->blocks[index] = p;
+            break;
+	case REALLOC: /* mm_realloc */
+            if ((p = mm_realloc(r->blocks[index], trace->ops[i].size)) == NULL)
+		app_error("mm_realloc error in replay_thread");
+            r->blocks[index] = p;
+            break;
+        case FREE: /* mm_free */
+            mm_free(r->blocks[index]);
+            break;
+	default:
+	    app_error("Nonexistent request type in replay_thread");
+        }
+
+	if (!r->independent)
+	    __atomic_store_n(&r->done[index], r->rank[i] + 1, __ATOMIC_RELEASE);
+	r->ops++;
+    }
+    r->end = replay_now();
+    return NULL;
+}
+
+/*
+ * replay - Replays the trace on a fresh heap with that many threads, 
+ *     and fills r (one replay_t per thread). Returns the time from the 
+ *     first start to the last end.
+ */
+static double replay(trace_t *trace, int threads, int independent, 
+		     int *rank, replay_t *r)
+{
+    pthread_t tids[MAX_THREADS];
+    pthread_barrier_t barrier;
+    int *done = NULL;
+    double start, end;
+    int t;
+
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in replay");
+
+    if (!independent && 
+	(done = (int *)calloc(trace->num_ids, sizeof(int))) == NULL)
+	unix_error("calloc failed in replay");
+    pthread_barrier_init(&barrier, NULL, threads);
+
+    for (t = 0; t < threads; t++) {
+	r[t].trace = trace;
+	r[t].thread = t;
+	r[t].threads = threads;
+	r[t].independent = independent;
+	r[t].rank = rank;
+	r[t].done = done;
+	r[t].barrier = &barrier;
+	r[t].ops = 0;
+	if (!independent)
+	    r[t].blocks = trace->blocks;
+	else if ((r[t].blocks = 
+		  (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	    unix_error("malloc failed in replay");
+	if (pthread_create(&tids[t], NULL, replay_thread, &r[t]) != 0)
+	    unix_error("pthread_create failed in replay");
+    }
+
+    start = end = 0;
+    for (t = 0; t < threads; t++) {
+	pthread_join(tids[t], NULL);
+	if (t == 0 || r[t].start < start)
+	    start = r[t].start;
+	if (r[t].end > end)
+	    end = r[t].end;
+	if (independent)
+	    free(r[t].blocks);
+    }
+    pthread_barrier_destroy(&barrier);
+    free(done);
+    return end - start;
+}
+
+/*
+ * eval_mm_threads - Replays the trace on one thread, then on threads 
+ *     threads at once, keeping the fastest of three runs each time
+ */
+static mtstats_t *eval_mm_threads(trace_t *trace, int threads, int independent)
+{
+    mtstats_t *mt;
+    replay_t r[MAX_THREADS];
+    int *rank, *count;
+    double secs;
+    int i, t, run;
+
+    if ((mt = (mtstats_t *)calloc(1, sizeof(mtstats_t))) == NULL ||
+	(rank = (int *)malloc(trace->num_ops * sizeof(int))) == NULL ||
+	(count = (int *)calloc(trace->num_ids, sizeof(int))) == NULL)
+	unix_error("malloc failed in eval_mm_threads");
+    for (i = 0; i < trace->num_ops; i++)
+	rank[i] = count[trace->ops[i].index]++;
+    free(count);
+
+    mt->threads = threads;
+    for (run = 0; run < 3; run++) {
+	secs = replay(trace, 1, independent, rank, r);
+	if (run == 0 || secs < mt->base_secs) {
+	    mt->base_secs = secs;
+	    mt->base_ops = r[0].ops;
+	}
+    }
+    for (run = 0; run < 3; run++) {
+	secs = replay(trace, threads, independent, rank, r);
+	if (run == 0 || secs < mt->secs) {
+	    mt->secs = secs;
+	    mt->ops = 0;
+	    for (t = 0; t < threads; t++) {
+		mt->ops += r[t].ops;
+		mt->thread_ops[t] = r[t].ops;
+		mt->thread_secs[t] = r[t].end - r[t].start;
+	    }
+	}
+    }
+    free(rank);
+    return mt;
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -833,7 +1729,8 @@ static void eval_mm_speed(void *ptr)
  */
 static int eval_libc_valid(trace_t *trace, int tracenum)
 {
-    int i, newsize;
+    int i;
+    size_t newsize;
     char *p, *newp, *oldp;
 
     for (i = 0;  i < trace->num_ops;  i++) {
@@ -877,7 +1774,8 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 static void eval_libc_speed(void *ptr)
 {
     int i;
-    int index, size, newsize;
+    int index;
+    size_t size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
@@ -910,6 +1808,59 @@ static void eval_libc_speed(void *ptr)
     }
 }
 
+/*************************************
+ * Latency histograms
+ ************************************/
+
+/*
+ * lat_record - Counts a latency of cycles in its bucket
+ */
+static void lat_record(lathist_t *hist, unsigned long cycles)
+{
+    int bucket, shift;
+
+    if (cycles < LAT_SUB) {
+	bucket = cycles;
+    }
+    else {
+	shift = 63 - __builtin_clzl(cycles) - LAT_SUB_LOG2;
+	bucket = ((shift + 1) << LAT_SUB_LOG2) + ((cycles >> shift) & (LAT_SUB - 1));
+    }
+    hist->count[bucket]++;
+    hist->n++;
+    if (cycles > hist->max)
+	hist->max = cycles;
+}
+
+/*
+ * lat_percentile - Returns an upper bound of the latency under which
+ *     a fraction p of the requests were, the highest value of its bucket
+ *     (or the largest latency measured, if it is smaller)
+ */
+static unsigned long lat_percentile(lathist_t *hist, double p)
+{
+    unsigned long rank, seen = 0;
+    unsigned long top = hist->max;
+    int bucket, shift;
+
+    rank = (unsigned long)(p * hist->n + 0.999999);
+    if (rank == 0)
+	rank = 1;
+    for (bucket = 0; bucket < LAT_BUCKETS; bucket++) {
+	seen += hist->count[bucket];
+	if (seen >= rank)
+	    break;
+    }
+    if (bucket < LAT_SUB) {
+	top = bucket;
+    }
+    else if (bucket < LAT_BUCKETS) {
+	shift = (bucket >> LAT_SUB_LOG2) - 1;
+	top = (((unsigned long)((bucket & (LAT_SUB - 1)) | LAT_SUB) + 1) << shift) - 1;
+    }
+    return (top < hist->max) ? top : hist->max;
+}
+
 /*************************************
  * Some miscellaneous helper routines
  ************************************/
@@ -970,6 +1921,258 @@ static void printresults(int n, stats_t *stats)
 	       "-");
     }
 
+    /* Print the multi-threaded throughput, if it was measured */
+    for (i=0; i < n && (!stats[i].valid || stats[i].mt == NULL); i++)
+	;
+    if (i < n) {
+	mtstats_t *mt;
+	int t;
+
+	printf("\nThreads (efficiency: Kops on all threads / threads x Kops on one)\n");
+	printf("%5s%9s%9s%10s%10s%11s\n", 
+	       "trace", "threads", "ops", "secs", "Kops", "efficiency");
+	for (i=0; i < n; i++) {
+	    if (!stats[i].valid || stats[i].mt == NULL)
+		continue;
+	    mt = stats[i].mt;
+	    printf("%2d%12d%9.0f%10.6f%10.0f\n",
+		   i, 1, mt->base_ops, mt->base_secs,
+		   (mt->base_ops/1e3)/mt->base_secs);
+	    printf("%2d%12d%9.0f%10.6f%10.0f%10.0f%%\n",
+		   i, mt->threads, mt->ops, mt->secs,
+		   (mt->ops/1e3)/mt->secs,
+		   100.0 * (mt->ops/mt->secs) / 
+		   (mt->threads * (mt->base_ops/mt->base_secs)));
+	    for (t = 0; t < mt->threads; t++)
+		printf("%10s %-3d%9.0f%10.6f%10.0f\n",
+		       "thread", t, mt->thread_ops[t], mt->thread_secs[t],
+		       (mt->thread_ops[t]/1e3)/mt->thread_secs[t]);
+	}
+    }
+
+    /* Print the hardware events, per request and for the whole trace, if they were counted */
+    for (i=0; i < n && (!stats[i].valid || stats[i].perf == NULL); i++)
+	;
+    if (i < n) {
+	double total[FPERF_EVENTS] = {0};
+	double perf_ops = 0;
+	int e;
+
+	printf("\nHardware events (-: not counted)\n");
+	printf("%5s%9s", "trace", "");
+	for (e = 0; e < FPERF_EVENTS; e++)
+	    printf("%11s", fperf_name(e));
+	printf("%7s\n", "IPC");
+	for (i=0; i < n; i++) {
+	    if (!stats[i].valid || stats[i].perf == NULL)
+		continue;
+	    printf("%2d%12s", i, "per op");
+	    for (e = 0; e < FPERF_EVENTS; e++) {
+		if (stats[i].perf[e] < 0)
+		    printf("%11s", "-");
+		else
+		    printf("%11.1f", stats[i].perf[e]/stats[i].ops);
+	    }
+	    if (stats[i].perf[FPERF_INSTRUCTIONS] < 0 || stats[i].perf[FPERF_CYCLES] <= 0)
+		printf("%7s\n", "-");
+	    else
+		printf("%7.2f\n", stats[i].perf[FPERF_INSTRUCTIONS]/stats[i].perf[FPERF_CYCLES]);
+	    printf("%14s", "trace");
+	    for (e = 0; e < FPERF_EVENTS; e++) {
+		if (stats[i].perf[e] < 0) {
+		    printf("%11s", "-");
+		    total[e] = -1;
+		}
+		else {
+		    printf("%11.0f", stats[i].perf[e]);
+		    if (total[e] >= 0)
+			total[e] += stats[i].perf[e];
+		}
+	    }
+	    printf("\n");
+	    perf_ops += stats[i].ops;
+	}
+	printf("%14s", "Total per op");
+	for (e = 0; e < FPERF_EVENTS; e++) {
+	    if (total[e] < 0)
+		printf("%11s", "-");
+	    else
+		printf("%11.1f", total[e]/perf_ops);
+	}
+	printf("\n");
+    }
+
+    /* Print the latency percentiles, in cycles, if they were measured */
+    for (i=0; i < n && (!stats[i].valid || stats[i].lat == NULL); i++)
+	;
+    if (i < n) {
+	static char *opnames[] = {"malloc", "free", "realloc"};
+	lathist_t *hist;
+	int type;
+
+	printf("\nLatency (cycles)\n");
+	printf("%5s%9s%9s%8s%8s%8s%8s%10s\n", 
+	       "trace", "request", "ops", "p50", "p90", "p99", "p99.9", "max");
+	for (i=0; i < n; i++) {
+	    if (!stats[i].valid || stats[i].lat == NULL)
+		continue;
+	    for (type = ALLOC; type <= REALLOC; type++) {
+		hist = &stats[i].lat[type];
+		if (hist->n == 0)
+		    continue;
+		printf("%2d%12s%9lu%8lu%8lu%8lu%8lu%10lu\n",
+		       i,
+		       opnames[type],
+		       hist->n,
+		       lat_percentile(hist, 0.50),
+		       lat_percentile(hist, 0.90),
+		       lat_percentile(hist, 0.99),
+		       lat_percentile(hist, 0.999),
+		       hist->max);
+	    }
+	}
+    }
+}
+
+/*
+ * csv_string, json_string - write str to f as a quoted CSV field (with
+ *    its quotes doubled) or a JSON string (with quotes, backslashes and
+ *    control characters escaped), so that any -N name or trace path
+ *    leaves the results readable
+ */
+static void csv_string(FILE *f, char *str)
+{
+    fputc('"', f);
+    for (; *str != '\0'; str++) {
+	if (*str == '"')
+	    fputc('"', f);
+	fputc(*str, f);
+    }
+    fputc('"', f);
+}
+
+static void json_string(FILE *f, char *str)
+{
+    fputc('"', f);
+    for (; *str != '\0'; str++) {
+	if (*str == '"' || *str == '\\')
+	    fprintf(f, "\\%c", *str);
+	else if ((unsigned char)*str < 0x20)
+	    fprintf(f, "\\u%04x", (unsigned char)*str);
+	else
+	    fputc(*str, f);
+    }
+    fputc('"', f);
+}
+
+/*
+ * writeresults - appends one row per trace to the CSV file csvfile (with
+ *    a header if the file is new) and one object per trace to the JSON
+ *    Lines file jsonfile, if given: the configuration of mm, the
+ *    allocator (mm or libc), utilization (mm only), time and throughput
+ *    mean and standard deviation over the trials, and the latency
+ *    percentiles with -L. What wasn't measured is empty, or null.
+ */
+static void writeresults(char *csvfile, char *jsonfile, char *config, char *allocator,
+			 int n, stats_t *stats, char **tracefiles)
+{
+    static char *opnames[] = {"malloc", "free", "realloc"};
+    static double percentiles[] = {0.50, 0.90, 0.99, 0.999};
+    static char *pnames[] = {"p50", "p90", "p99", "p99.9"};
+    FILE *csv = NULL, *json = NULL;
+    lathist_t *hist;
+    int measured_util = !strcmp(allocator, "mm"); /* not for libc */
+    int i, type, p;
+
+    if (csvfile != NULL) {
+	if ((csv = fopen(csvfile, "a")) == NULL)
+	    unix_error("ERROR: can't open the CSV file");
+	if (ftell(csv) == 0) {
+	    fprintf(csv, "config,allocator,trace,valid,util,ops,secs,secs_sd,kops,kops_sd");
+	    for (type = ALLOC; type <= REALLOC; type++) {
+		for (p = 0; p < 4; p++)
+		    fprintf(csv, ",%s_%s", opnames[type], pnames[p]);
+		fprintf(csv, ",%s_max", opnames[type]);
+	    }
+	    fprintf(csv, "\n");
+	}
+    }
+    if (jsonfile != NULL && (json = fopen(jsonfile, "a")) == NULL)
+	unix_error("ERROR: can't open the JSON file");
+
+    for (i = 0; i < n; i++) {
+	if (csv != NULL) {
+	    csv_string(csv, config);
+	    fprintf(csv, ",%s,", allocator);
+	    csv_string(csv, tracefiles[i]);
+	    fprintf(csv, ",%d", stats[i].valid);
+	    if (stats[i].valid && measured_util)
+		fprintf(csv, ",%.4f", stats[i].util);
+	    else
+		fprintf(csv, ",");
+	    if (stats[i].valid)
+		fprintf(csv, ",%.0f,%.9f,%.9f,%.1f,%.1f", stats[i].ops,
+			stats[i].secs, stats[i].secs_sd, stats[i].kops, stats[i].kops_sd);
+	    else
+		fprintf(csv, ",,,,,");
+	    for (type = ALLOC; type <= REALLOC; type++) {
+		hist = (stats[i].valid && stats[i].lat != NULL) ? &stats[i].lat[type] : NULL;
+		for (p = 0; p < 4; p++)
+		    if (hist != NULL && hist->n != 0)
+			fprintf(csv, ",%lu", lat_percentile(hist, percentiles[p]));
+		    else
+			fprintf(csv, ",");
+		if (hist != NULL && hist->n != 0)
+		    fprintf(csv, ",%lu", hist->max);
+		else
+		    fprintf(csv, ",");
+	    }
+	    fprintf(csv, "\n");
+	}
+	if (json != NULL) {
+	    fprintf(json, "{\"config\": ");
+	    json_string(json, config);
+	    fprintf(json, ", \"allocator\": ");
+	    json_string(json, allocator);
+	    fprintf(json, ", \"trace\": ");
+	    json_string(json, tracefiles[i]);
+	    fprintf(json, ", \"valid\": %s", stats[i].valid ? "true" : "false");
+	    if (stats[i].valid) {
+		if (measured_util)
+		    fprintf(json, ", \"util\": %.4f", stats[i].util);
+		else
+		    fprintf(json, ", \"util\": null");
+		fprintf(json, ", \"ops\": %.0f, \"secs\": %.9f, \"secs_sd\": %.9f, "
+			"\"kops\": %.1f, \"kops_sd\": %.1f",
+			stats[i].ops, stats[i].secs, stats[i].secs_sd,
+			stats[i].kops, stats[i].kops_sd);
+		fprintf(json, ", \"latency\": ");
+		if (stats[i].lat == NULL)
+		    fprintf(json, "null");
+		else {
+		    fprintf(json, "{");
+		    for (type = ALLOC; type <= REALLOC; type++) {
+			hist = &stats[i].lat[type];
+			fprintf(json, "%s\"%s\": ", (type == ALLOC) ? "" : ", ", opnames[type]);
+			if (hist->n == 0) {
+			    fprintf(json, "null");
+			    continue;
+			}
+			fprintf(json, "{\"n\": %lu", hist->n);
+			for (p = 0; p < 4; p++)
+			    fprintf(json, ", \"%s\": %lu", pnames[p], lat_percentile(hist, percentiles[p]));
+			fprintf(json, ", \"max\": %lu}", hist->max);
+		    }
+		    fprintf(json, "}");
+		}
+	    }
+	    fprintf(json, "}\n");
+	}
+    }
+    if (csv != NULL)
+	fclose(csv);
+    if (json != NULL)
+	fclose(json);
 }
 
 /* 
@@ -1004,14 +2207,27 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValLiPc] [-f <file>] [-t <dir>] [-B <file>] [-T <n>] [-H <size>]\n\t       [-n <trials>] [-C <file>] [-J <file>] [-N <name>]\n\t       [-S <n>[,<max>] [<trace>...]]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-B <file>  Convert the -f trace to a binary trace in <file>.\n");
+    fprintf(stderr, "\t-c         Check the heap with mm_check after every request.\n");
+    fprintf(stderr, "\t-C <file>  Append the results of every trace to the CSV file <file>.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H <size>  Heap ceiling in bytes, with an optional K, M or G suffix.\n");
+    fprintf(stderr, "\t-i         With -T, every thread replays the whole trace.\n");
+    fprintf(stderr, "\t-J <file>  Append them to the JSON Lines file <file>, an object per line.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L         Print latency percentiles of mm requests (with -v).\n");
+    fprintf(stderr, "\t-n <n>     Time every trace n times, for a mean and a standard deviation.\n");
+    fprintf(stderr, "\t-N <name>  Name of the mm configuration in the -C and -J results.\n");
+    fprintf(stderr, "\t-P         Print hardware events per request, from perf_event_open (with -v).\n");
+    fprintf(stderr, "\t-S <n>[,<max>] Print a header of n slab size classes for requests of at most\n");
+    fprintf(stderr, "\t           max bytes (64), fitted to the -f trace, the operands or the default traces.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <n>     Also replay on n threads, sharded by block id (with -v).\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
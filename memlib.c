@@ -1,8 +1,39 @@
 /*
- * memlib.c - a module that simulates the memory system.  Needed because it 
- *            allows us to interleave calls from the student's malloc package 
+ * memlib.c - a module that simulates the memory system.  Needed because it
+ *            allows us to interleave calls from the student's malloc package
  *            with the system's malloc package in libc.
+ *
+ *            The heap can be split in several segments, each with its own
+ *            brk pointer, so that several arenas can grow independently.
+ *            By default there is a single segment spanning the whole heap.
+ *
+ *            The heap can hold at most MAX_HEAP bytes, unless another
+ *            ceiling is given at run time, with mem_set_max_heap or in
+ *            the MEM_MAX_HEAP environment variable (a number of bytes,
+ *            with an optional K, M or G suffix), before mem_init.
+ *
+ *            With MEM_MMAP, the heap is only reserved with mmap(PROT_NONE),
+ *            and made accessible by chunks of MEM_COMMIT_CHUNK bytes as the
+ *            brk pointers grow. Shrinking a segment gives the chunks above
+ *            the brk back to the system.
+ *
+ *            With MEM_HUGEPAGES too, the heap is backed by pages of
+ *            MEM_HUGEPAGE_SIZE bytes: reserved in hugetlbfs pages if the
+ *            pool has enough of them, otherwise aligned on a huge page
+ *            and flagged for transparent huge pages, otherwise in normal
+ *            pages. It is then committed by whole huge pages.
+ *
+ *            With MEM_NUMA too, the segments are spread over the NUMA nodes
+ *            the process may use, in round robin, and each one is bound to
+ *            its node with mbind: its pages come from that node only.
+ *
+ *            Huge blocks can also get mappings of their own outside of the
+ *            heap (mem_map, mem_unmap, mem_remap). memlib keeps track of
+ *            them so that the driver can check payloads and count them in
+ *            the memory used. The records are taken from pages mapped for
+ *            them, not from malloc, which may be the package itself.
  */
+#define _GNU_SOURCE /* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -10,64 +41,482 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "memlib.h"
 #include "config.h"
 
+#if MEM_HUGEPAGES && !MEM_MMAP
+#error "MEM_HUGEPAGES needs MEM_MMAP"
+#endif
+#if MEM_NUMA && !MEM_MMAP
+#error "MEM_NUMA needs MEM_MMAP"
+#endif
+
 /* private variables */
 static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static char *mem_max_addr;   /* largest legal heap address */
+static size_t mem_max_size;  /* heap ceiling in bytes, 0 until set */
+static int mem_nsegs = 1;    /* number of segments the heap is split in */
+static size_t mem_seg_len;   /* bytes reserved for each segment */
+static char *mem_brk[MEM_MAX_SEGMENTS]; /* points to last byte of each segment */
+static char *mem_peak_brk[MEM_MAX_SEGMENTS]; /* highest brk of each segment since the reset */
+static int mem_nnodes = 1;   /* number of NUMA nodes the segments are spread over */
+
+/* mappings handed out by mem_map, in a list protected by mem_map_lock */
+typedef struct mem_mapping {
+    char *start;
+    size_t size;
+    struct mem_mapping *next;
+} mem_mapping_t;
+
+static mem_mapping_t *mem_mappings;
+static mem_mapping_t *mem_free_records; /* records of unmapped mappings, to reuse */
+static size_t mem_mapped;       /* bytes currently mapped */
+static size_t mem_peak_mapped;  /* and at most since the reset */
+static pthread_mutex_t mem_map_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#if MEM_MMAP
+static char *mem_commit_brk[MEM_MAX_SEGMENTS]; /* end of the accessible part of each segment */
+static size_t mem_map_len;   /* length of the mapping reserved for the heap */
+
+/* pages backing the heap */
+#define MEM_PAGES_NORMAL  0
+#define MEM_PAGES_THP     1  /* transparent huge pages, asked with madvise */
+#define MEM_PAGES_HUGETLB 2  /* hugetlbfs pages, reserved with the mapping */
+static int mem_pages = MEM_PAGES_NORMAL;
+
+#define MEM_COMMIT_CHUNK (64*1024)
+static size_t mem_chunk = MEM_COMMIT_CHUNK; /* a huge page with MEM_HUGEPAGES */
+#define CHUNK_ROUNDUP(p) \
+    ((char *)(((size_t)(p) + mem_chunk - 1) & ~(size_t)(mem_chunk - 1)))
+
+#if MEM_NUMA
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 
-/* 
+#define MEM_NODE_IDS 1024 /* node ids handled: the node masks have as many bits */
+#define MASK_BITS (8 * sizeof(unsigned long))
+static int mem_node_ids[MEM_MAX_NODES]; /* system id of each node the heap is spread over */
+
+/*
+ * mem_find_nodes - list the nodes the process may take memory from, at
+ *    most MEM_MAX_NODES of them. Without NUMA support in the kernel,
+ *    there is a single node 0.
+ */
+static void mem_find_nodes(void)
+{
+    unsigned long mask[MEM_NODE_IDS / MASK_BITS];
+    int id;
+
+    mem_nnodes = 0;
+    if (syscall(SYS_get_mempolicy, NULL, mask, MEM_NODE_IDS + 1, NULL,
+		MPOL_F_MEMS_ALLOWED) == 0) {
+	for (id = 0; id < MEM_NODE_IDS && mem_nnodes < MEM_MAX_NODES; id++)
+	    if (mask[id / MASK_BITS] & (1UL << (id % MASK_BITS)))
+		mem_node_ids[mem_nnodes++] = id;
+    }
+    if (mem_nnodes == 0) {
+	mem_node_ids[0] = 0;
+	mem_nnodes = 1;
+    }
+}
+
+/*
+ * mem_bind - bind [lo, hi), in segment seg, to the node of the segment.
+ *    Nothing is moved: the pages already there stay where they are.
+ */
+static void mem_bind(char *lo, char *hi, int seg)
+{
+    unsigned long mask[MEM_NODE_IDS / MASK_BITS];
+    int id = mem_node_ids[mem_seg_node(seg)];
+
+    if (hi <= lo)
+	return;
+    memset(mask, 0, sizeof(mask));
+    mask[id / MASK_BITS] = 1UL << (id % MASK_BITS);
+    /* without NUMA support the pages come from anywhere, as before */
+    syscall(SYS_mbind, lo, hi - lo, MPOL_BIND, mask, MEM_NODE_IDS + 1, 0);
+}
+#endif
+
+/*
+ * mem_commit - make [lo, hi) accessible (prot != PROT_NONE) or give it
+ *    back to the system, dropping its content (prot == PROT_NONE)
+ */
+static void mem_commit(char *lo, char *hi, int prot)
+{
+    if (hi <= lo)
+	return;
+    if (prot == PROT_NONE && mem_pages == MEM_PAGES_HUGETLB) {
+	/* the pages go back to the pool, but stay reserved for the heap */
+	if (mprotect(lo, hi - lo, PROT_NONE) < 0) {
+	    fprintf(stderr, "mem_commit: mprotect error\n");
+	    exit(1);
+	}
+	madvise(lo, hi - lo, MADV_DONTNEED);
+    }
+    else if (prot == PROT_NONE) {
+	/* a fresh mapping over the range drops the pages */
+	if (mmap(lo, hi - lo, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS |
+		 MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED) {
+	    fprintf(stderr, "mem_commit: mmap error\n");
+	    exit(1);
+	}
+#if MEM_HUGEPAGES
+	/* which has lost the flag of the old one */
+	if (mem_pages == MEM_PAGES_THP)
+	    madvise(lo, hi - lo, MADV_HUGEPAGE);
+#endif
+#if MEM_NUMA
+	/* and its node */
+	mem_bind(lo, hi, mem_seg_of(lo));
+#endif
+    }
+    else if (mprotect(lo, hi - lo, prot) < 0) {
+	fprintf(stderr, "mem_commit: mprotect error\n");
+	exit(1);
+    }
+}
+
+#if MEM_HUGEPAGES
+/*
+ * mem_reserve_huge - reserve size bytes (a multiple of the huge page
+ *    size) for the heap, in huge pages if the system has some to give
+ */
+static char *mem_reserve_huge(size_t size)
+{
+    char *p, *start;
+    size_t extra;
+
+    /* hugetlbfs pages are taken from the pool as the mapping is made:
+       it fails right away, rather than on a fault, if too few are free */
+#ifdef MAP_HUGETLB
+    p = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+	mem_pages = MEM_PAGES_HUGETLB;
+	mem_map_len = size;
+	return p;
+    }
+#endif
+
+    /* otherwise reserve one huge page more, to cut an aligned part */
+    extra = MEM_HUGEPAGE_SIZE;
+    p = mmap(NULL, size + extra, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS |
+	     MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED)
+	return p;
+    start = (char *)(((size_t)p + MEM_HUGEPAGE_SIZE - 1) & ~(size_t)(MEM_HUGEPAGE_SIZE - 1));
+    if (start > p)
+	munmap(p, start - p);
+    if (start + size < p + size + extra)
+	munmap(start + size, p + size + extra - (start + size));
+    mem_map_len = size;
+#ifdef MADV_HUGEPAGE
+    if (madvise(start, size, MADV_HUGEPAGE) == 0)
+	mem_pages = MEM_PAGES_THP;
+#endif
+    return start;
+}
+#endif
+#endif
+
+/*
+ * mem_set_max_heap - set the heap ceiling to size bytes (rounded up to
+ *    a multiple of the page size). Must be called before mem_init.
+ */
+void mem_set_max_heap(size_t size)
+{
+    mem_max_size = (size + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+}
+
+/*
+ * mem_max_heap - returns the heap ceiling in bytes
+ */
+size_t mem_max_heap(void)
+{
+    char *env, *end;
+    unsigned long long size;
+
+    if (mem_max_size != 0)
+	return mem_max_size;
+    if ((env = getenv("MEM_MAX_HEAP")) == NULL || *env == '\0') {
+	mem_set_max_heap(MAX_HEAP);
+	return mem_max_size;
+    }
+    size = strtoull(env, &end, 10);
+    switch (*end) {
+    case 'G': case 'g':
+	size <<= 10;
+	/* fall through */
+    case 'M': case 'm':
+	size <<= 10;
+	/* fall through */
+    case 'K': case 'k':
+	size <<= 10;
+	end++;
+    }
+    if (size == 0 || *end != '\0' || size > (size_t)-1 / 2) {
+	fprintf(stderr, "mem_init: bad MEM_MAX_HEAP value %s\n", env);
+	exit(1);
+    }
+    mem_set_max_heap((size_t)size);
+    return mem_max_size;
+}
+
+/*
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
+    size_t max_heap = mem_max_heap();
+
     /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
+#if MEM_MMAP
+#if MEM_HUGEPAGES
+    /* the heap and its chunks are whole huge pages */
+    max_heap = (max_heap + MEM_HUGEPAGE_SIZE - 1) & ~(size_t)(MEM_HUGEPAGE_SIZE - 1);
+    mem_set_max_heap(max_heap);
+    mem_start_brk = mem_reserve_huge(max_heap);
+    mem_chunk = (mem_pages == MEM_PAGES_NORMAL) ? MEM_COMMIT_CHUNK : MEM_HUGEPAGE_SIZE;
+#else
+    mem_start_brk = (char *)mmap(NULL, max_heap, PROT_NONE, MAP_PRIVATE |
+				 MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    mem_map_len = max_heap;
+#endif
+    if (mem_start_brk == (char *)MAP_FAILED) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
+	exit(1);
+    }
+    mem_nsegs = 1;
+    mem_seg_len = max_heap;
+    mem_commit_brk[0] = mem_start_brk;
+#if MEM_NUMA
+    mem_find_nodes();
+#endif
+#else
+    if ((mem_start_brk = (char *)malloc(max_heap)) == NULL) {
 	fprintf(stderr, "mem_init_vm: malloc error\n");
 	exit(1);
     }
+#endif
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
+    mem_max_addr = mem_start_brk + max_heap;  /* max legal heap address */
+    mem_set_segments(1);                      /* heap is empty initially */
 }
 
-/* 
+/*
  * mem_deinit - free the storage used by the memory system model
  */
 void mem_deinit(void)
 {
+#if MEM_MMAP
+    munmap(mem_start_brk, mem_map_len);
+    mem_pages = MEM_PAGES_NORMAL;
+#else
     free(mem_start_brk);
+#endif
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointers to make an empty heap,
+ *    and unmap the mappings left
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    int i;
+    mem_mapping_t *m;
+
+    while ((m = mem_mappings) != NULL) {
+	mem_mappings = m->next;
+	munmap(m->start, m->size);
+	m->next = mem_free_records;
+	mem_free_records = m;
+    }
+    mem_mapped = mem_peak_mapped = 0;
+
+    for (i = 0; i < mem_nsegs; i++) {
+	mem_brk[i] = mem_peak_brk[i] = mem_start_brk + i * mem_seg_len;
+#if MEM_MMAP
+	mem_commit(mem_brk[i], mem_commit_brk[i], PROT_NONE);
+	mem_commit_brk[i] = mem_brk[i];
+#endif
+    }
+}
+
+/*
+ * mem_seg_end - returns the address past the last byte a segment can
+ *    grow to
+ */
+static char *mem_seg_end(int seg)
+{
+    return (seg == mem_nsegs - 1) ? mem_max_addr :
+	mem_start_brk + (seg + 1) * mem_seg_len;
+}
+
+/*
+ * mem_set_segments - split the heap in count segments of equal size
+ *    (rounded down to a multiple of the page size, of the huge page
+ *    size with hugetlbfs pages), and empty them. With MEM_NUMA, each
+ *    one is bound to its node.
+ */
+void mem_set_segments(int count)
+{
+    size_t align = mem_pagesize();
+    int i;
+
+    assert(count > 0 && count <= MEM_MAX_SEGMENTS);
+#if MEM_MMAP
+    /* hugetlbfs pages can't be shared by two segments */
+    if (mem_pages == MEM_PAGES_HUGETLB)
+	align = MEM_HUGEPAGE_SIZE;
+#endif
+
+#if MEM_MMAP
+    /* give back what the old segments used before moving them */
+    mem_reset_brk();
+#endif
+    mem_nsegs = count;
+    mem_seg_len = (count == 1) ? mem_max_size :
+	(mem_max_size / count) & ~(align - 1);
+    mem_reset_brk();
+#if MEM_NUMA
+    for (i = 0; i < count; i++)
+	mem_bind(mem_seg_lo(i), mem_seg_end(i), i);
+#else
+    (void)i;
+#endif
 }
 
-/* 
- * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+/*
+ * mem_seg_sbrk - simple model of the sbrk function for one segment.
+ *    Extends the segment by incr bytes and returns the start address
+ *    of the new area, or shrinks it if incr is negative (and returns
+ *    the old brk, as sbrk).
  */
-void *mem_sbrk(int incr) 
+void *mem_seg_sbrk(int seg, intptr_t incr)
 {
-    char *old_brk = mem_brk;
+    char *old_brk = mem_brk[seg];
+    char *seg_max_addr = mem_seg_end(seg);
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    /* compare distances, so that a huge incr can't wrap the pointer */
+    if (incr > seg_max_addr - old_brk) {
 	errno = ENOMEM;
-	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+#if !MM_SILENT
+	/* a full segment is not a full heap: the package may try the others */
+	if (mem_nsegs == 1)
+	    fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+#endif
 	return (void *)-1;
     }
-    mem_brk += incr;
+    if (incr < (char *)mem_seg_lo(seg) - old_brk) {
+	errno = EINVAL;
+#if !MM_SILENT
+	fprintf(stderr, "ERROR: mem_sbrk failed. Shrinking below the heap start...\n");
+#endif
+	return (void *)-1;
+    }
+    mem_brk[seg] += incr;
+    if (mem_brk[seg] > mem_peak_brk[seg])
+	mem_peak_brk[seg] = mem_brk[seg];
+#if MEM_MMAP
+    if (mem_brk[seg] > mem_commit_brk[seg]) {
+	/* the end of the last segment may not be on a chunk boundary */
+	char *commit = CHUNK_ROUNDUP(mem_brk[seg]);
+	if (commit > seg_max_addr)
+	    commit = seg_max_addr;
+	mem_commit(mem_commit_brk[seg], commit, PROT_READ | PROT_WRITE);
+	mem_commit_brk[seg] = commit;
+    }
+    else if (CHUNK_ROUNDUP(mem_brk[seg]) < mem_commit_brk[seg]) {
+	mem_commit(CHUNK_ROUNDUP(mem_brk[seg]), mem_commit_brk[seg], PROT_NONE);
+	mem_commit_brk[seg] = CHUNK_ROUNDUP(mem_brk[seg]);
+    }
+#endif
     return (void *)old_brk;
 }
 
+/*
+ * mem_sbrk - extends the first segment (the whole heap by default)
+ */
+void *mem_sbrk(intptr_t incr)
+{
+    return mem_seg_sbrk(0, incr);
+}
+
+/*
+ * mem_seg_lo - return address of the first byte of a segment
+ */
+void *mem_seg_lo(int seg)
+{
+    return (void *)(mem_start_brk + seg * mem_seg_len);
+}
+
+/*
+ * mem_seg_hi - return address of the last byte of a segment
+ */
+void *mem_seg_hi(int seg)
+{
+    return (void *)(mem_brk[seg] - 1);
+}
+
+/*
+ * mem_seg_heapsize - returns the size of a segment in bytes
+ */
+size_t mem_seg_heapsize(int seg)
+{
+    return (size_t)(mem_brk[seg] - (char *)mem_seg_lo(seg));
+}
+
+/*
+ * mem_nodes - returns the number of NUMA nodes the segments are spread
+ *    over: 1 without MEM_NUMA
+ */
+int mem_nodes(void)
+{
+    return mem_nnodes;
+}
+
+/*
+ * mem_seg_node - returns the node (from 0 to mem_nodes() - 1) a
+ *    segment is bound to
+ */
+int mem_seg_node(int seg)
+{
+    return seg % mem_nnodes;
+}
+
+/*
+ * mem_node - returns the node (as mem_seg_node) of the processor the
+ *    calling thread is running on, or -1 if it is not one of the nodes
+ *    of the segments
+ */
+int mem_node(void)
+{
+#if MEM_NUMA
+    unsigned int cpu, id;
+    int i;
+
+    if (syscall(SYS_getcpu, &cpu, &id, NULL) != 0)
+	return 0;
+    for (i = 0; i < mem_nnodes; i++)
+	if (mem_node_ids[i] == (int)id)
+	    return i;
+    return -1;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * mem_seg_of - returns the segment holding the address p
+ */
+int mem_seg_of(void *p)
+{
+    int seg = (int)(((char *)p - mem_start_brk) / mem_seg_len);
+    return (seg < mem_nsegs) ? seg : mem_nsegs - 1;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -76,20 +525,244 @@ void *mem_heap_lo()
     return (void *)mem_start_brk;
 }
 
-/* 
- * mem_heap_hi - return address of last heap byte
+/*
+ * mem_heap_hi - return address of last heap byte (the highest one
+ *    among the segments)
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    int i;
+    char *hi = mem_brk[0];
+
+    for (i = 1; i < mem_nsegs; i++)
+	if (mem_brk[i] > (char *)mem_seg_lo(i) && mem_brk[i] > hi)
+	    hi = mem_brk[i];
+    return (void *)(hi - 1);
+}
+
+/*
+ * mem_heapsize() - returns the heap size in bytes (summed over the
+ *    segments)
+ */
+size_t mem_heapsize()
+{
+    int i;
+    size_t size = 0;
+
+    for (i = 0; i < mem_nsegs; i++)
+	size += mem_seg_heapsize(i);
+    return size;
+}
+
+/*
+ * mem_peak_heapsize() - returns the heap size in bytes the segments
+ *    reached at most since the last reset (summed over the segments)
+ */
+size_t mem_peak_heapsize()
+{
+    int i;
+    size_t size = 0;
+
+    for (i = 0; i < mem_nsegs; i++)
+	size += (size_t)(mem_peak_brk[i] - (char *)mem_seg_lo(i));
+    return size;
+}
+
+/*
+ * mem_new_record - returns a free mapping record, mapping a page of them
+ *    if there is none left. The lock must be held.
+ */
+static mem_mapping_t *mem_new_record(void)
+{
+    mem_mapping_t *m;
+    size_t i, count = mem_pagesize() / sizeof(mem_mapping_t);
+
+    if (mem_free_records == NULL) {
+	m = mmap(NULL, mem_pagesize(), PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (m == (mem_mapping_t *)MAP_FAILED)
+	    return NULL;
+	for (i = 0; i < count; i++) {
+	    m[i].next = mem_free_records;
+	    mem_free_records = &m[i];
+	}
+    }
+    m = mem_free_records;
+    mem_free_records = m->next;
+    return m;
+}
+
+/*
+ * mem_map - map size bytes (a multiple of the page size) outside of the
+ *    heap, returns their address or NULL if there is no memory
+ */
+void *mem_map(size_t size)
+{
+    mem_mapping_t *m;
+    char *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (p == (char *)MAP_FAILED)
+	return NULL;
+
+    pthread_mutex_lock(&mem_map_lock);
+    if ((m = mem_new_record()) == NULL) {
+	pthread_mutex_unlock(&mem_map_lock);
+	munmap(p, size);
+	return NULL;
+    }
+    m->start = p;
+    m->size = size;
+    m->next = mem_mappings;
+    mem_mappings = m;
+    mem_mapped += size;
+    if (mem_mapped > mem_peak_mapped)
+	mem_peak_mapped = mem_mapped;
+    pthread_mutex_unlock(&mem_map_lock);
+    return (void *)p;
+}
+
+/*
+ * mem_find_mapping - returns the link pointing to the mapping starting
+ *    at p. The lock must be held.
+ */
+static mem_mapping_t **mem_find_mapping(void *p)
+{
+    mem_mapping_t **m;
+
+    for (m = &mem_mappings; *m != NULL; m = &(*m)->next)
+	if ((*m)->start == (char *)p)
+	    return m;
+    fprintf(stderr, "ERROR: %p is not a mapping\n", p);
+    exit(1);
+}
+
+/*
+ * mem_unmap - unmap a mapping returned by mem_map
+ */
+void mem_unmap(void *p)
+{
+    mem_mapping_t **link, *m;
+
+    pthread_mutex_lock(&mem_map_lock);
+    link = mem_find_mapping(p);
+    m = *link;
+    *link = m->next;
+    mem_mapped -= m->size;
+    munmap(m->start, m->size);
+    m->next = mem_free_records;
+    mem_free_records = m;
+    pthread_mutex_unlock(&mem_map_lock);
+}
+
+/*
+ * mem_remap - resize a mapping returned by mem_map to size bytes (a
+ *    multiple of the page size). It may move, without copying the pages.
+ *    Returns its new address, or NULL if there is no memory (the old
+ *    mapping is then left as is).
+ */
+void *mem_remap(void *p, size_t size)
+{
+    mem_mapping_t *m;
+    char *newp;
+
+    pthread_mutex_lock(&mem_map_lock);
+    m = *mem_find_mapping(p);
+    newp = mremap(m->start, m->size, size, MREMAP_MAYMOVE);
+    if (newp == (char *)MAP_FAILED) {
+	pthread_mutex_unlock(&mem_map_lock);
+	return NULL;
+    }
+    mem_mapped += size - m->size;
+    if (mem_mapped > mem_peak_mapped)
+	mem_peak_mapped = mem_mapped;
+    m->start = newp;
+    m->size = size;
+    pthread_mutex_unlock(&mem_map_lock);
+    return (void *)newp;
+}
+
+/*
+ * mem_move_pages - move size bytes of pages (page-aligned) from src, in
+ *    the heap, to dst, in a mapping, without copying them. src is given
+ *    fresh zero pages. Returns 0 on success, -1 if the pages can't be
+ *    moved (nothing changed then).
+ */
+int mem_move_pages(void *dst, void *src, size_t size)
+{
+#if MEM_MMAP
+    /* hugetlbfs pages only move by whole huge pages, and not out of the pool */
+    if (mem_pages == MEM_PAGES_HUGETLB)
+	return -1;
+#endif
+    if (mremap(src, size, size, MREMAP_MAYMOVE | MREMAP_FIXED, dst) == MAP_FAILED)
+	return -1;
+    /* the heap must stay accessible where the pages were */
+    if (mmap(src, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS |
+	     MAP_FIXED, -1, 0) == MAP_FAILED) {
+	fprintf(stderr, "mem_move_pages: mmap error\n");
+	exit(1);
+    }
+#if MEM_MMAP && MEM_HUGEPAGES
+    if (mem_pages == MEM_PAGES_THP)
+	madvise(src, size, MADV_HUGEPAGE);
+#endif
+#if MEM_NUMA
+    /* nor its node */
+    mem_bind(src, (char *)src + size, mem_seg_of(src));
+#endif
+    return 0;
+}
+
+/*
+ * mem_is_mapped - returns 1 if [lo, hi] lies in a single mapping
+ */
+int mem_is_mapped(void *lo, void *hi)
+{
+    mem_mapping_t *m;
+    int found = 0;
+
+    pthread_mutex_lock(&mem_map_lock);
+    for (m = mem_mappings; m != NULL && !found; m = m->next)
+	found = ((char *)lo >= m->start && (char *)hi < m->start + m->size);
+    pthread_mutex_unlock(&mem_map_lock);
+    return found;
+}
+
+/*
+ * mem_mapped_bytes() - returns the number of bytes mapped right now
+ */
+size_t mem_mapped_bytes()
+{
+    size_t mapped;
+
+    pthread_mutex_lock(&mem_map_lock);
+    mapped = mem_mapped;
+    pthread_mutex_unlock(&mem_map_lock);
+    return mapped;
+}
+
+/*
+ * mem_peak_mapped_bytes() - returns the number of bytes mapped at most
+ *    at the same time since the last reset
+ */
+size_t mem_peak_mapped_bytes()
+{
+    return mem_peak_mapped;
 }
 
 /*
- * mem_heapsize() - returns the heap size in bytes
+ * mem_heap_pagesize() - returns the size of the pages backing the heap:
+ *    a huge page if memlib got some with MEM_HUGEPAGES, otherwise the
+ *    page size of the system
  */
-size_t mem_heapsize() 
+size_t mem_heap_pagesize()
 {
-    return (size_t)(mem_brk - mem_start_brk);
+#if MEM_MMAP
+    if (mem_pages != MEM_PAGES_NORMAL)
+	return MEM_HUGEPAGE_SIZE;
+#endif
+    return mem_pagesize();
 }
 
 /*
@@ -1,11 +1,43 @@
 #include <unistd.h>
+#include <stdint.h>
 
-void mem_init(void);               
+/* maximum number of segments the heap can be split in */
+#define MEM_MAX_SEGMENTS 64
+
+/* maximum number of NUMA nodes the segments are spread over */
+#define MEM_MAX_NODES 8
+
+void mem_set_max_heap(size_t size);
+size_t mem_max_heap(void);
+void mem_init(void);
 void mem_deinit(void);
-void *mem_sbrk(int incr);
-void mem_reset_brk(void); 
+void *mem_sbrk(intptr_t incr);
+void mem_reset_brk(void);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_peak_heapsize(void);
 size_t mem_pagesize(void);
+size_t mem_heap_pagesize(void);
+
+/* independent segments, one per arena */
+void mem_set_segments(int count);
+void *mem_seg_sbrk(int seg, intptr_t incr);
+void *mem_seg_lo(int seg);
+void *mem_seg_hi(int seg);
+size_t mem_seg_heapsize(int seg);
+int mem_seg_of(void *p);
+
+/* NUMA nodes of the segments (with MEM_NUMA), numbered from 0 */
+int mem_nodes(void);
+int mem_seg_node(int seg);
+int mem_node(void);
 
+/* mappings outside of the heap, for huge blocks */
+void *mem_map(size_t size);
+void mem_unmap(void *p);
+void *mem_remap(void *p, size_t size);
+int mem_move_pages(void *dst, void *src, size_t size);
+int mem_is_mapped(void *lo, void *hi);
+size_t mem_mapped_bytes(void);
+size_t mem_peak_mapped_bytes(void);
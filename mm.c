@@ -1,31 +1,80 @@
 /*
  * We implemented an adress-ordered explicit free list with best fit and bidirectionnal coalescing, with custom realloc.
- * We don't use any global variable.
- * 
+ * We don't use any global variable (except for the arenas and the slab page map): the roots of the free block index live at the very beginning of the heap (mem_heap_lo()).
+ *
  * Every block has a header corresponding to its full block size. Since blocks are 8-bits aligned, we use the first bit of the size to store an "allocated" flag: 0 if the block is free, 1 otherwise. There is no footer.
  * Every allocated block contains the header and the payload, that extends until the next block's header.
  * Every free block contains, in addition to the header, two pointers: one to the next free block, one to the previous. It then has undefined bit values until its end (defined by header adress + size).
- * 
- * To malloc, we use a best-fit approach. If no block is found and the last one is free, we extend by the just right amount.
+ * With MM_BOUNDARY_TAGS, free blocks also get a footer and the next block a PREV_FREE flag, as in TLSF below, so free finds the left neighbour in constant time.
+ * With MM_COMPACT_LINKS, the pointers are 32 bits offsets from the beginning of the heap, so the smallest block is 16 bytes instead of 24.
+ *
+ * To malloc, we use a best-fit approach (or the placement policy chosen with MM_PLACEMENT). If no block is found and the last one is free, we extend by the just right amount.
  * To free, we use a bidirectionnal coalescing and preserve the adress order of the free list in a linear cost.
+ * When the last block of the heap becomes free and larger than MM_TRIM_THRESHOLD, we shrink the heap to leave only MM_TRIM_PAD free bytes at its end.
+ * When a free forms a block of at least MM_MADVISE_PAGES pages elsewhere, the pages inside it are given back to the system with madvise.
+ * Requests of at least MM_MMAP_THRESHOLD bytes get a mapping of their own from memlib, outside of the heap, and the MMAPPED flag
+ * (third bit of the header): free unmaps them and realloc resizes the mapping with mremap, so they never leave holes in the heap.
+ * With MM_DEFERRED_FREE, free only puts the block in a small pending set, still marked allocated; the set is sorted by adress
+ * and freed in one pass (adjacent pending blocks first merged together) when it is full or before malloc grows the heap.
+ * With MM_QUICK_CACHE, free first puts small blocks in a LIFO cache of their exact size, still marked allocated, from which malloc
+ * takes them back in a few instructions; a full class is flushed into the index, and every class before malloc grows the heap.
+ * With MM_STATS, counters kept in the root as the heap changes are read by mm_stats (see the statistics section).
  * To realloc, we try to extends the block in place if the one after is free. If it is the last block of the heap we extend the memory by the appropriate amount. Otherwise we call malloc then free.
- * 
+ *
+ * The free blocks are reached through a small "index" interface (index_insert, index_remove, index_find...), implemented once per mode.
+ * With MM_ARENAS, there is one such heap per arena, each in its own memlib segment and behind its own lock; threads are
+ * bound to arenas in round robin (among the arenas of their NUMA node with MEM_NUMA), and a block is freed by the arena
+ * that owns it (see the arenas section).
+ * With MM_REMOTE_FREE, a thread freeing a block of another arena doesn't take its lock: it pushes the block on a lock-free
+ * stack of that arena with a compare and swap, and the arena frees the whole stack when one of its mallocs finds no fit.
+ *
+ * The mode is chosen at compile time in config.h:
+ *  - default: the adress-ordered list described above.
+ *  - MM_TLSF: a two-level segregated fit. Free blocks are kept in LIFO lists, one per size class, and two levels of bitmaps
+ *    tell which lists are non empty, so a good fit is found with two find-first-set in constant time.
+ *    Since the lists are not adress-ordered anymore, the left neighbour is found with boundary tags: free blocks get a footer
+ *    (a copy of their size in their last word) and the block after a free block has the PREV_FREE flag (second bit of the header) set.
+ *    Allocated blocks still have no footer. Free and malloc are both O(1).
+ *  - MM_ADDR_TREE: the free blocks are still adress-ordered, but kept in a treap (a binary search tree by adress, balanced
+ *    as a heap on a random priority) instead of the list. The two pointers of a free block become its left and right
+ *    children, and its priority is a hash of its adress, so nothing else is stored. Finding the place of a freed block
+ *    and its left neighbour is a descent of the tree, so free is O(log n). Best fit still visits every free block.
+ *  - MM_SIZE_TREE: the free blocks are kept in a treap ordered by (size, adress), so the best fit is found in one descent:
+ *    the smallest block at least as large as the request, the one with the lowest adress in case of ties, as with the list.
+ *    On its own, it replaces the list and relies on boundary tags to coalesce like TLSF. Together with MM_ADDR_TREE,
+ *    every free block is in both trees (four links), and the adress tree keeps finding the neighbours when coalescing.
+ *  - MM_PACKED_INDEX: the list, mirrored in two dense arrays of sizes and adresses sorted by adress. Best fit becomes a
+ *    vectorized scan of the sizes, and finding the left neighbour a binary search; freeing a block costs a memmove.
+ *
+ *
+ * With MM_SLABS, requests of at most SLAB_MAX_OBJECT bytes don't get a block of their own: they are served from slabs,
+ * blocks of SLAB_SIZE bytes aligned on their size and cut in objects of a single size class, with no header. Each class
+ * keeps a list of its slabs having free objects, and the free objects of a slab are linked through their first word.
+ * A page map (one byte per SLAB_SIZE bytes of heap) tells mm_free whether a pointer lies in a slab, whose beginning is
+ * then found by rounding the pointer down to a multiple of SLAB_SIZE (see the slabs section).
+ *
+ * With MM_REALLOC_SLACK, the heap root has a table, indexed by adress, of the blocks that grew with realloc: how often
+ * and the size they need. A block that has grown MM_REALLOC_SLACK times and has to move gets half as much room again;
+ * the slack is split off when the block shrinks or is evicted, and before the heap grows (see slack_realloc).
+ *
  * Look at each functions's docstring for a further description of the implementations and optimisations.
  *
  * We provide two functions to print and debug the free list as well as the whole heap. Various cheks are perfomed, descriped in the respective docstrings. We combine the two functions in mm_check().
- * 
+ *
  *                                              We achieve a consistent 94/100.
- * 
+ *
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
-#include <math.h>
+#include <stdint.h>
+#include <sys/mman.h>
 
 #include "mm.h"
 #include "memlib.h"
+#include "config.h"
 
 /*********************************************************
  * NOTE TO STUDENTS: Before you do anything else, please
@@ -53,6 +102,9 @@ team_t team = {
 
 #define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
 
+/* largest payload a heap block can be asked for: its block size must not wrap around, nor be a negative sbrk increment */
+#define MAX_PAYLOAD (PTRDIFF_MAX - SIZE_T_SIZE - ALIGNMENT)
+
 
 #define BLOCK_HEADER    0
 #define BLOCK_END       2
@@ -60,6 +112,293 @@ team_t team = {
 #define BLOCK_FORWARD   3
 #define BLOCK_BACKWARD  4
 
+/* Flags stored in the low bits of the header, always 0 in the size thanks to the alignment */
+#define ALLOC_FLAG      1   // the block is allocated
+#define PREV_FREE_FLAG  2   // the block just before is free (only maintained with boundary tags)
+#define MMAPPED_FLAG    4   // the block has a mapping of its own, outside of the heap
+#define FLAG_MASK       7
+
+#define GET_SIZE(block) (*(size_t *)(block) & ~(size_t)FLAG_MASK)
+#define IS_ALLOC(block) (*(size_t *)(block) & ALLOC_FLAG)
+#define IS_MMAPPED(block) (*(size_t *)(block) & MMAPPED_FLAG)
+
+/*
+ * Segregated modes lose the adress order of the free blocks, so they need boundary tags to find
+ * the left neighbour of a block when coalescing. The adress-ordered modes can use them too (MM_BOUNDARY_TAGS).
+ */
+#if MM_TLSF && (MM_ADDR_TREE || MM_SIZE_TREE)
+#error "MM_TLSF can't be combined with the trees"
+#endif
+
+#if MM_TLSF || (MM_SIZE_TREE && !MM_ADDR_TREE)
+#define ADDR_ORDERED    0
+#define BOUNDARY_TAGS   1
+#else
+#define ADDR_ORDERED    1
+#define BOUNDARY_TAGS   MM_BOUNDARY_TAGS    // optional, to find the left neighbour in constant time
+#endif
+
+/*
+ * The placement policy (MM_PLACEMENT) is applied while scanning the free blocks, so only the list and the adress
+ * tree have one. The size tree always finds the best fit, and TLSF a good fit from the size classes.
+ */
+#define SCANNED_INDEX   (!MM_TLSF && !MM_SIZE_TREE)
+#if MM_PLACEMENT != MM_PLACE_BEST && !SCANNED_INDEX
+#error "MM_PLACEMENT only applies to the adress-ordered list and tree"
+#endif
+#if MM_PACKED_INDEX && (!SCANNED_INDEX || MM_ADDR_TREE || MM_PLACEMENT != MM_PLACE_BEST)
+#error "MM_PACKED_INDEX only applies to the adress-ordered list with best fit"
+#endif
+
+#if MM_PLACEMENT == MM_PLACE_FIRST
+#define PLACEMENT_NAME  "first fit"
+#elif MM_PLACEMENT == MM_PLACE_NEXT
+#define PLACEMENT_NAME  "next fit"
+#elif MM_PLACEMENT == MM_PLACE_GOOD
+#define STR(x)          #x
+#define XSTR(x)         STR(x)
+#define PLACEMENT_NAME  "good fit (" XSTR(MM_GOOD_FIT_CANDIDATES) " candidates, " XSTR(MM_GOOD_FIT_SLACK) "% slack)"
+#else
+#define PLACEMENT_NAME  "best fit"
+#endif
+
+/* Name of the index and placement policy, printed by mdriver */
+#if MM_TLSF
+const char *mm_placement = "TLSF, good fit";
+#elif MM_ADDR_TREE && MM_SIZE_TREE
+const char *mm_placement = "address and size trees, best fit";
+#elif MM_SIZE_TREE
+const char *mm_placement = "size tree, best fit";
+#elif MM_ADDR_TREE
+const char *mm_placement = "address tree, " PLACEMENT_NAME;
+#else
+const char *mm_placement = "address-ordered list, " PLACEMENT_NAME;
+#endif
+
+#if BOUNDARY_TAGS
+#define PREV_FREE       PREV_FREE_FLAG
+#define FOOTER_SIZE     SIZE_T_SIZE
+#else
+#define PREV_FREE       0
+#define FOOTER_SIZE     0
+#endif
+
+/* Every free block needs room for its header, its links and its footer (if any) */
+#define LINK_NEXT       0
+#define LINK_PREV       1
+#define LINK_LEFT       0   // children of a node, in tree modes
+#define LINK_RIGHT      1
+#if MM_ADDR_TREE && MM_SIZE_TREE
+#define LINK_WORDS      4   // the size tree uses the two links after the ones of the adress tree
+#define SIZE_TREE_LINKS 2
+#else
+#define LINK_WORDS      2
+#define SIZE_TREE_LINKS 0
+#endif
+#if MM_COMPACT_LINKS
+#if MAX_HEAP > 0xFFFFFFFF
+#error "MM_COMPACT_LINKS needs a heap smaller than 4 GB"
+#endif
+typedef unsigned int link_t;    // offset of the target block from the beginning of the heap, 0 for NULL
+#else
+typedef void *link_t;
+#endif
+#define MIN_BLOCK_SIZE  ALIGN(SIZE_T_SIZE + LINK_WORDS*sizeof(link_t) + FOOTER_SIZE)
+
+#if MM_QUICK_CACHE
+/* Quick cache classes: one per block size, from MIN_BLOCK_SIZE to QUICK_MAX_BLOCK */
+#define QUICK_MAX_BLOCK     256
+#define QUICK_CLASSES       ((QUICK_MAX_BLOCK - MIN_BLOCK_SIZE) / ALIGNMENT + 1)
+#define QUICK_CLASS(size)   (((size) - MIN_BLOCK_SIZE) / ALIGNMENT)
+#endif
+
+#if MM_TLSF
+/*
+ * TLSF size classes. Blocks smaller than TLSF_SMALL_BLOCK all go to the first level 0, split in classes of ALIGNMENT bytes.
+ * Above, the first level is the position of the highest bit of the size, and the second level is given by the next TLSF_SL_LOG2 bits.
+ */
+#define TLSF_SL_LOG2        4
+#define TLSF_SL_COUNT       (1 << TLSF_SL_LOG2)
+#define TLSF_FL_SHIFT       (TLSF_SL_LOG2 + 3)
+#define TLSF_SMALL_BLOCK    (1 << TLSF_FL_SHIFT)
+#define TLSF_FL_INDEX_MAX   36  // blocks are smaller than 64 GB, mm_init refuses larger heaps
+#define TLSF_FL_COUNT       (TLSF_FL_INDEX_MAX - TLSF_FL_SHIFT + 1)
+#endif
+
+#if MM_SLABS
+/*
+ * Slab size classes. A slab is a block of exactly SLAB_SIZE bytes whose payload starts on a multiple of SLAB_SIZE: the header
+ * of the block after it is in its last word, so the next slab can start right after. It begins with a slab_t, then the objects.
+ * Slabs are smaller than a system page: every class used holds at least one slab, which is costly in small heaps.
+ * The classes come from a header generated by mdriver -S (MM_SLAB_CLASSES, slab_classes.h by default).
+ */
+#define SLAB_SIZE           1024
+#define SLAB_PAYLOAD        (SLAB_SIZE - SIZE_T_SIZE)
+
+#include MM_SLAB_CLASSES
+
+#if SLAB_MAX_OBJECT > SLAB_SIZE / 4
+#error "slab objects can't be larger than a quarter of a slab"
+#endif
+#endif
+
+#if MM_STATS
+/*
+ * heap_stats_t - Counters of a heap, updated by the allocator code and summed by mm_stats.
+ * The largest free block is raised whenever a free block gets its header. When a block of that size is used or
+ * shrunk, the value is only known to be an upper bound (stale) until mm_stats looks for the largest in the index.
+ */
+typedef struct {
+    size_t live_bytes;                  // in allocated blocks
+    size_t free_blocks;
+    size_t largest_free;
+    int largest_stale;
+    unsigned long visited;              // free blocks given to the placement policy or descended through
+    unsigned long max_visited;          // by a single malloc
+    unsigned long mallocs;
+    unsigned long splits;
+    unsigned long coalesces;
+    unsigned long reallocs_in_place;
+    unsigned long realloc_copies;
+    unsigned long sbrk_calls;
+} heap_stats_t;
+#endif
+
+#if MM_REALLOC_SLACK
+/*
+ * slack_t - A block that grew with realloc: how many times, and the block size the last realloc needed. The rest of
+ * the block is slack, reserved when it moved so that it can grow in place, and split off when it is not needed any more.
+ */
+typedef struct {
+    void *block;
+    size_t used;
+    unsigned int grows;
+} slack_t;
+#endif
+
+/*
+ * heap_root_t - What we store at mem_heap_lo(), before the first block: the entry points of the free block index.
+ */
+typedef struct {
+#if MM_TLSF
+    unsigned long fl_map;                              // bit i set if sl_map[i] != 0
+    unsigned int sl_map[TLSF_FL_COUNT];                // bit j of sl_map[i] set if heads[i][j] != NULL
+    void *heads[TLSF_FL_COUNT][TLSF_SL_COUNT];         // first free block of each size class
+#elif MM_ADDR_TREE || MM_SIZE_TREE
+    void *root;                                        // root of the adress-ordered treap
+    void *size_root;                                   // root of the size-ordered treap
+#else
+    void *head;                                        // first free block of the adress-ordered list
+    void *tail;                                        // last one
+#if MM_PACKED_INDEX
+    size_t *packed_sizes;                              // sizes of the free blocks of the list, in the same order
+    void **packed_blocks;                              // and their adresses
+    size_t packed_count;
+    size_t packed_room;                                // entries the arrays can hold, 0 before they are mapped
+    int packed_failed;                                 // set if they could not grow, the list is walked instead
+#endif
+#endif
+#if MM_PLACEMENT == MM_PLACE_NEXT
+    void *rover;                                       // where the last search stopped, for next fit
+#endif
+#if BOUNDARY_TAGS
+    size_t epilogue;                                   // header bits of a virtual block just after the end of the heap
+#endif
+#if MM_SLABS
+    void *slabs[SLAB_CLASSES];                         // first slab with free objects of each class
+#endif
+#if MM_DEFERRED_FREE
+    void *pending[MM_DEFERRED_FREE];                   // blocks freed but not coalesced yet, still marked allocated
+    unsigned int pending_count;
+#endif
+#if MM_QUICK_CACHE
+    void *quick[QUICK_CLASSES];                        // last cached block of each size, linked through their first link
+    unsigned int quick_count[QUICK_CLASSES];
+#endif
+#if MM_REALLOC_SLACK
+    slack_t slack[MM_SLACK_BLOCKS];                    // blocks that grew with realloc, by hash of their adress
+#endif
+#if MM_STATS
+    heap_stats_t stats;
+#endif
+} heap_root_t;
+
+#if MM_REMOTE_FREE && !MM_ARENAS
+#error "MM_REMOTE_FREE needs MM_ARENAS"
+#endif
+
+#if MM_ARENAS
+#include <pthread.h>
+
+/*
+ * arena_t - With MM_ARENAS, every arena has its own heap in its own memlib segment (whose beginning holds the roots
+ * of its free block index as usual) and its own lock. Every thread is bound to one arena for its mallocs, and a block
+ * is always freed in the arena that owns it.
+ * With MM_REMOTE_FREE, the blocks freed by the threads of other arenas wait on a lock-free stack, linked through the
+ * first word of their payload, and each arena gets a cache line of its own as every thread writes to those stacks.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+#if MM_REMOTE_FREE
+    void *remote;                           // last block pushed by a thread of another arena, NULL if none
+} __attribute__((aligned(64))) arena_t;
+#else
+} arena_t;
+#endif
+
+static arena_t arenas[MM_ARENAS];
+static pthread_once_t arenas_once = PTHREAD_ONCE_INIT;
+static int next_arena[MM_ARENAS];           // next arena a new thread gets bound to, by first arena of its node
+static __thread int thread_arena = -1;      // arena this thread allocates from
+static __thread int current_arena = 0;      // arena whose heap the thread is working on
+
+#define HEAP_LO()           mem_seg_lo(current_arena)
+#define HEAP_HI()           mem_seg_hi(current_arena)
+#define HEAP_SIZE()         mem_seg_heapsize(current_arena)
+#define HEAP_SBRK(incr)     mem_seg_sbrk(current_arena, incr)
+#else
+#define HEAP_LO()           mem_heap_lo()
+#define HEAP_HI()           mem_heap_hi()
+#define HEAP_SIZE()         mem_heapsize()
+#define HEAP_SBRK(incr)     mem_sbrk(incr)
+#endif
+
+#define ROOT            ((heap_root_t *)HEAP_LO())
+#define ROOT_SIZE       ALIGN(sizeof(heap_root_t))
+#define FIRST_BLOCK     ((void *)((char *)HEAP_LO() + ROOT_SIZE))
+#define HEAP_END        ((void *)((char *)HEAP_HI() + 1)) // +1 since HEAP_HI() points to last byte
+
+#if MM_STATS
+#define STAT_ADD(field, n)  (ROOT->stats.field += (n))
+// a free block of size bytes is used or shrunk
+#define STAT_USED(size)     ((size) == ROOT->stats.largest_free ? (ROOT->stats.largest_stale = 1) : 0)
+#else
+#define STAT_ADD(field, n)
+#define STAT_USED(size)
+#endif
+
+#if MM_SLABS
+/*
+ * slab_t - The beginning of a slab. Slabs of a class having free objects are in a doubly linked list starting in the root.
+ */
+typedef struct slab {
+    struct slab *next;                  // other slabs of the class having free objects
+    struct slab *prev;
+    void *free;                         // first free object, the next one is stored in its first word
+    unsigned int class;
+    unsigned int used;                  // number of allocated objects
+} slab_t;
+
+#define SLAB_HEADER_SIZE    ALIGN(sizeof(slab_t))
+
+/*
+ * slab_pages[i] is 1 if the i-th SLAB_SIZE bytes of the memlib heap are a slab. Shared by the arenas, each only writes its own pages.
+ * Sized by mm_init after the heap ceiling, and mapped on demand so that large ceilings only cost address space.
+ */
+static unsigned char *slab_pages;
+static size_t slab_page_count;
+#endif
+
 /*
  * moved_pointer - Used to do pointer arithmetic and easily travel through different positions in block
  *                "blocklen" can be set to 0 when it is not needed
@@ -86,572 +425,2980 @@ void* moved_pointer(void* point_in, size_t blocklen, int position_point, int pos
     }
 }
 
-// debug functions
-
 /*
- * free_list_debug - Prints in a readable way the free list, and performs cheks along the way:
- *  - Is each free block actually flagged as free?
- *  - Is the bachward pointer indeed pointing toward the previous element of the list?
- *  - Are the adresses well ordered in the list? (We rely on an adress-ordered free list to optimize some parts of the code) 
- *  - Are there contiguous free blocks that escaped coalescing? 
- * 
- * verbose = 1 will print, verbose = 0 will only check. 
- * returns 1 if everything went well, otherwise print error message and returns 0.       
+ * get_link / set_link - Read and write the links stored in the payload of a free block.
+ * Links always point to the header of the target block (or are NULL).
+ * With MM_COMPACT_LINKS, they are stored as 32 bits offsets from the beginning of the heap (of the arena), where the
+ * root is, so that 0 is never a block.
  */
-int free_list_debug(int verbose){
-    if(verbose)printf("\n___FREE LIST:___\n");
+static inline void *get_link(void *block, int link){
+    link_t target = ((link_t *)moved_pointer(block, 0, BLOCK_HEADER, BLOCK_FORWARD))[link];
+#if MM_COMPACT_LINKS
+    return (target == 0) ? NULL : (char *)HEAP_LO() + target;
+#else
+    return target;
+#endif
+}
 
-    void **pos = *(void***)mem_heap_lo();
+static inline void set_link(void *block, int link, void *target){
+#if MM_COMPACT_LINKS
+    link_t offset = (target == NULL) ? 0 : (link_t)((char *)target - (char *)HEAP_LO());
+#else
+    link_t offset = target;
+#endif
+    ((link_t *)moved_pointer(block, 0, BLOCK_HEADER, BLOCK_FORWARD))[link] = offset;
+}
 
-     if(pos==NULL || *pos==NULL){
-        return;
+/*
+ * set_header - Writes the header of a block with its size and flags.
+ * With boundary tags, a free block also gets its footer, and the block after it (or the epilogue) learns
+ * through its PREV_FREE flag whether this one is free. With MM_STATS, a free block may raise the largest free size.
+ */
+static void set_header(void *block, size_t size, size_t flags){
+    *(size_t *)block = size | flags;
+#if MM_STATS
+    // every free block is smaller than largest_free, so a larger one is the largest
+    if (!(flags & ALLOC_FLAG) && size > ROOT->stats.largest_free){
+        ROOT->stats.largest_free = size;
+        ROOT->stats.largest_stale = 0;
     }
+#endif
+#if BOUNDARY_TAGS
+    void *next = moved_pointer(block, size, BLOCK_HEADER, BLOCK_END);
+    size_t *next_header = (next == HEAP_END) ? &ROOT->epilogue : (size_t *)next;
+    if (flags & ALLOC_FLAG){
+        *next_header &= ~(size_t)PREV_FREE_FLAG;
+    } else {
+        *(size_t *)((char *)next - SIZE_T_SIZE) = size;
+        *next_header |= PREV_FREE_FLAG;
+    }
+#endif
+}
 
-    void **prevpos = NULL;
-    size_t size = 0;
-    size_t prevsize = 0;
-
-    while (pos!=NULL){
-        size = *(size_t*)moved_pointer(pos, 0, BLOCK_FORWARD, BLOCK_HEADER);
-        if(verbose){
-            printf("   Forward position : %p\n", pos);
-            printf("   Forward  : %p\n", *pos);
-            printf("   Backward : %p\n", *(void**)moved_pointer(pos, 0, BLOCK_FORWARD, BLOCK_BACKWARD));
-            printf("   Header : %zu\n", size);
-        }
-
-        // some sanity checks
-        
-        //is the backward link indeed pointing towards the previous element?
-        if (prevpos != NULL && *(void **)moved_pointer(pos, 0, BLOCK_FORWARD, BLOCK_BACKWARD) != moved_pointer(prevpos, 0, BLOCK_FORWARD, BLOCK_BACKWARD)){
-            printf("   Backwards pointer is WRONG \n");
-            return 0;
-        }
+#if BOUNDARY_TAGS
+/*
+ * left_free_block - Returns the free block just before block using its footer, or NULL if the block before is allocated.
+ * block can be HEAP_END, in which case the flag is read in the epilogue.
+ */
+static void *left_free_block(void *block){
+    size_t header = (block == HEAP_END) ? ROOT->epilogue : *(size_t *)block;
+    if (!(header & PREV_FREE_FLAG)){
+        return NULL;
+    }
+    return (char *)block - *(size_t *)((char *)block - SIZE_T_SIZE);
+}
+#endif
 
-        // is every block of the list free?
-        
-        if(size%2==1){
-            printf("   The block is not flagged as free\n");
-            return 0;
-        }
+/////// free block index
 
-        // are the adresses in increasing order?
-        
-        if(pos <= prevpos){
-            printf("   The adresses are not well ordered\n");
-            return 0;
-        }
+#if SCANNED_INDEX
+/*
+ * fit_t - State of a scan of the free blocks looking for a fit.
+ */
+typedef struct {
+    void *best_p;       // best candidate so far
+    size_t best_s;      // and its size
+    int candidates;     // number of blocks large enough seen, for good fit
+} fit_t;
 
-        // Did the free blocks escape coalescing?
-        
-        if(prevpos!=NULL && moved_pointer(prevpos,prevsize,BLOCK_FORWARD,BLOCK_END) == moved_pointer(pos,0,BLOCK_FORWARD,BLOCK_HEADER)){
-            printf("   The two last blocks escaped coalescing\n");
-            return 0;
-        }
-        prevpos = pos;
-        prevsize=size;
-        // follow linked list
-        pos = (void**)*pos;
-        
+/*
+ * fit_consider - The placement policy: called on each free block in the order of the scan, returns 1 when the scan
+ * can stop, fit->best_p then being the block to use. The policy is known at compile time, so this is specialized.
+ *  - best fit: keeps the smallest block large enough, stops on a perfect fit.
+ *  - first fit / next fit: takes the first block large enough (next fit only scans from somewhere else).
+ *  - good fit: as best fit, but stops after MM_GOOD_FIT_CANDIDATES blocks large enough, or on a block wasting at most
+ *    MM_GOOD_FIT_SLACK percent of the size.
+ */
+static inline int fit_consider(fit_t *fit, void *block, size_t size){
+    size_t size_act = GET_SIZE(block);
+    STAT_ADD(visited, 1);
+    if (size_act < size){
+        return 0;
     }
+#if MM_PLACEMENT == MM_PLACE_FIRST || MM_PLACEMENT == MM_PLACE_NEXT
+    fit->best_p = block;
     return 1;
+#else
+    if (fit->best_p == NULL || size_act < fit->best_s){
+        fit->best_p = block;
+        fit->best_s = size_act;
+    }
+#if MM_PLACEMENT == MM_PLACE_GOOD
+    return ++fit->candidates >= MM_GOOD_FIT_CANDIDATES || (size_act - size) * 100 <= size * MM_GOOD_FIT_SLACK;
+#else
+    return size_act == size;
+#endif
+#endif
 }
+#endif
 
 /*
- * print_heap_blocks - Prints in a readable way the whole heap as it is and its boundaries, 
- * and cheks along the way if every free block is in the free list. 
- *
- * if verbose = 1, it will print. If verbose = 0, it will only check.
- * returns 1 if everything went well, otherwise print error message and returns 0.         
+ * The index keeps track of every free block. Each mode implements:
+ *  - index_insert(block, pred): adds a free block (header already written). pred is its predecessor in adress order when
+ *    the index is adress-ordered and the caller already knows it, otherwise it is ignored.
+ *  - index_remove(block): removes a free block, its header must still be valid.
+ *  - index_replace(old, new, size): new takes the place of old, which is removed, and gets its header. new is in the same gap
+ *    between allocated blocks, and may overlap old.
+ *  - index_resize(block, size): changes the size of a free block that stays at the same adress.
+ *  - index_find(size): returns a free block of at least size bytes, or NULL.
+ *  - index_prev(block): (adress-ordered only, unless boundary tags find the neighbours) returns the free block with the
+ *    largest adress below block, or NULL. The list also uses it with boundary tags, to insert a block in order.
+ *  - index_last(): (adress-ordered without boundary tags only) returns the free block with the largest adress, or NULL.
+ *  - index_largest(): (with MM_STATS only) returns the size of the largest free block, or 0.
  */
-int print_heap_blocks(int verbose){
-    
-    if(verbose){
-        printf("\n___HEAP BLOCKS PRINT___\n");
-        printf("First block is start of linked list\n  pos = %p \n  pointing to: %p\n",mem_heap_lo(),*(void **)mem_heap_lo());
+
+#if MM_TLSF
+
+/*
+ * tlsf_mapping - Computes the first and second level indexes of the size class containing size.
+ */
+static void tlsf_mapping(size_t size, int *fl, int *sl){
+    if (size < TLSF_SMALL_BLOCK){
+        *fl = 0;
+        *sl = (int)(size / (TLSF_SMALL_BLOCK / TLSF_SL_COUNT));
+    } else {
+        int high_bit = 63 - __builtin_clzl(size);
+        *sl = (int)(size >> (high_bit - TLSF_SL_LOG2)) ^ TLSF_SL_COUNT;
+        *fl = high_bit - TLSF_FL_SHIFT + 1;
     }
+}
 
-    size_t *pos = (size_t*)ALIGN((size_t)((char*)mem_heap_lo()+1));
-    size_t current_size_header = *pos;
+static void index_insert(void *block, void *pred){
+    int fl, sl;
+    tlsf_mapping(GET_SIZE(block), &fl, &sl);
 
-    if(current_size_header==0){
-        printf("empty\n");
-        return 2;
+    // LIFO insertion at the head of the class list
+    void *head = ROOT->heads[fl][sl];
+    set_link(block, LINK_NEXT, head);
+    set_link(block, LINK_PREV, NULL);
+    if (head != NULL){
+        set_link(head, LINK_PREV, block);
     }
+    ROOT->heads[fl][sl] = block;
+    ROOT->fl_map |= 1ul << fl;
+    ROOT->sl_map[fl] |= 1u << sl;
+}
 
-    void* next_free_block = *(void**)mem_heap_lo();
-    size_t *end_of_heap = (size_t *)((char*)mem_heap_hi()+1); // +1 since mem_heap_hi() points to last byte
+static void index_remove(void *block){
+    int fl, sl;
+    tlsf_mapping(GET_SIZE(block), &fl, &sl);
 
-    if(verbose)printf("Start of heap.\n");
+    void *next = get_link(block, LINK_NEXT);
+    void *prev = get_link(block, LINK_PREV);
+    if (next != NULL){
+        set_link(next, LINK_PREV, prev);
+    }
+    if (prev != NULL){
+        set_link(prev, LINK_NEXT, next);
+    } else {
+        // it was the head of its list, which may now be empty
+        ROOT->heads[fl][sl] = next;
+        if (next == NULL){
+            ROOT->sl_map[fl] &= ~(1u << sl);
+            if (ROOT->sl_map[fl] == 0){
+                ROOT->fl_map &= ~(1ul << fl);
+            }
+        }
+    }
+}
 
-    //we jump from blocks to blocks untill we reach the heap boundary
-    while (pos!=end_of_heap){
+static void index_replace(void *old, void *new, size_t size){
+    index_remove(old);
+    set_header(new, size, 0);
+    index_insert(new, NULL);
+}
 
-        if(verbose)printf("\nblock at adress %p :\n",pos);
-        current_size_header = *pos;
+static void index_resize(void *block, size_t size){
+    index_remove(block);
+    set_header(block, size, 0);
+    index_insert(block, NULL);
+}
 
-        // is the block allocated? Use flag stored in first bit of size to know
-        unsigned short allocated = current_size_header & 1;
-        if(allocated){
-            if(verbose)printf("  allocated\n");
-        }else{
-            if(verbose)printf("  free block \n");
-            // Does this adress corresponds to the one indicated by the last forward pointer of the linked list?
-            if(next_free_block!=moved_pointer(pos,0,BLOCK_HEADER,BLOCK_FORWARD)){
-                printf("  free block not in free list!\n");
-                return 0;
-            }
-            //follow the linked list
-            next_free_block = *(void**)moved_pointer(pos,0,BLOCK_HEADER,BLOCK_FORWARD);
+/*
+ * index_find - Rounds size up to the next class boundary, so that any block of the class found fits,
+ * then looks for the first non empty class with the bitmaps.
+ */
+static void *index_find(size_t size){
+    int fl, sl;
+    if (size >= TLSF_SMALL_BLOCK){
+        size += ((size_t)1 << (63 - __builtin_clzl(size) - TLSF_SL_LOG2)) - 1;
+    }
+    tlsf_mapping(size, &fl, &sl);
+    if (fl >= TLSF_FL_COUNT){
+        return NULL;
+    }
+
+    // first non empty class of the same first level and at least as large
+    unsigned int sl_map = ROOT->sl_map[fl] & (~0u << sl);
+    if (sl_map == 0){
+        // otherwise, the smallest class of the next non empty first level
+        unsigned long fl_map = (fl + 1 < TLSF_FL_COUNT) ? ROOT->fl_map & (~0ul << (fl + 1)) : 0;
+        if (fl_map == 0){
+            return NULL;
         }
-        
-        if(verbose)printf("  size = %zu\n",current_size_header);
-        // jump size bytes ahead. & ~1 to get true size without allocated flag.
-        pos = (size_t*)moved_pointer(pos,current_size_header & ~1,BLOCK_HEADER,BLOCK_END);
+        fl = __builtin_ctzl(fl_map);
+        sl_map = ROOT->sl_map[fl];
     }
-    if(verbose)printf("end of heap: %p\n",mem_heap_hi());
-    return 1;
+    sl = __builtin_ctz(sl_map);
+    STAT_ADD(visited, 1);
+    return ROOT->heads[fl][sl];
 }
 
+#if MM_STATS
 /*
- * mm_check - calls the two functions print_heap_blocks and free_list_debug to perform checks on the heap.
- * See above docstrings for details. 
- * Nothing is printed.
- *  
- * returns 1 if both functions spotted no error, otherwise print error message and returns 0.       
+ * index_largest - Returns the size of the largest free block, 0 if there is none: the largest of the highest class.
  */
-int mm_check(void){
-    return print_heap_blocks(0) & free_list_debug(0);
+static size_t index_largest(void){
+    if (ROOT->fl_map == 0){
+        return 0;
+    }
+    int fl = 63 - __builtin_clzl(ROOT->fl_map);
+    int sl = 31 - __builtin_clz(ROOT->sl_map[fl]);
+    size_t largest = 0;
+    for (void *block = ROOT->heads[fl][sl]; block != NULL; block = get_link(block, LINK_NEXT)){
+        if (GET_SIZE(block) > largest){
+            largest = GET_SIZE(block);
+        }
+    }
+    return largest;
 }
+#endif
 
-/////// memory allocator code
+#elif MM_ADDR_TREE || MM_SIZE_TREE
 
 /*
- * mm_init - initialize the malloc package. Nothing to do as we don't use any global variable.
+ * The treaps are binary search trees, balanced as a heap on a random priority. The adress tree is ordered by adress;
+ * the size tree by size, ties being broken by adress. Both can be kept at the same time in different links of the block.
  */
-int mm_init(void)
-{
-    return 0;
+#define TREE_BY_ADDR    0
+#define TREE_BY_SIZE    1
+#define TREE_LINK(by_size, child)   ((by_size) ? SIZE_TREE_LINKS + (child) : (child))
+
+/*
+ * treap_priority - The priority of a node is a hash of its adress (murmur3 finalizer), so that we don't have to store it.
+ */
+static inline unsigned long treap_priority(void *block){
+    unsigned long x = (unsigned long)block;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdUL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53UL;
+    x ^= x >> 33;
+    return x;
 }
 
-/* 
- * mm_malloc - Allocate a block and returns its adress.
- * Always allocate a block whose size is a multiple of the alignment.
- * 
- *  - Tries to find best fit among free blocks (minimal size difference) if possible. If perfect fit is found stops earlier.
- *  - If a fit is found, if possible split the free block in two: the part we use to allocate the new pointer, and the new free part.
- *  - If previous search fails, since we are adress ordered we point to the last free block. If it's the heap's last block, then we extend the heap by the just right amount.
- *  - Otherwise extends memory by the asked size.
- * 
+/*
+ * treap_less - Order of the blocks in the tree: (size, adress) in the size tree, adress only in the other one.
  */
-void *mm_malloc(size_t size)
-{   
-    // To be sure there is enough space to put pointers when freed (2*pointer)
-    if ((int)size < 2*sizeof(void *)){
-        size = (size_t) 2*sizeof(void *);
+static inline int treap_less(void *a, void *b, int by_size){
+    if (by_size && GET_SIZE(a) != GET_SIZE(b)){
+        return GET_SIZE(a) < GET_SIZE(b);
     }
+    return a < b;
+}
 
-    size_t newsize = ALIGN(size + SIZE_T_SIZE); // Size is payload size, newsize includes full block
-    
-    if (mem_heapsize() == 0){ // Basically first call
-        // Start writing after letting 1 byte for first free list pointer
-        void *p = mem_sbrk(newsize+sizeof(void *))+sizeof(void *);
-        if ((void*)ALIGN((size_t)p)!=p){
-            mem_sbrk(ALIGN((size_t)p)-(size_t)p);
-            p = (void*)ALIGN((size_t)p);
-        }
-        *(void **)mem_heap_lo() = NULL; // Points to first free block (none)
-        if (p == (void *)-1){
-            printf("Unknown error when allocating first block\n");
-            return NULL;
-        }else {
-            // Place size signs
-            *(size_t *)p = newsize + 1;
-            return (void *)moved_pointer(p, newsize, BLOCK_HEADER, BLOCK_PAYLOAD);
-        }
+/*
+ * treap_split - Splits the tree rooted at node into the blocks below key (left) and above key (right).
+ */
+static void treap_split(void *node, void *key, void **left, void **right, int by_size){
+    if (node == NULL){
+        *left = NULL;
+        *right = NULL;
+    } else if (treap_less(node, key, by_size)){
+        void *rest;
+        treap_split(get_link(node, TREE_LINK(by_size, LINK_RIGHT)), key, &rest, right, by_size);
+        set_link(node, TREE_LINK(by_size, LINK_RIGHT), rest);
+        *left = node;
+    } else {
+        void *rest;
+        treap_split(get_link(node, TREE_LINK(by_size, LINK_LEFT)), key, left, &rest, by_size);
+        set_link(node, TREE_LINK(by_size, LINK_LEFT), rest);
+        *right = node;
     }
+}
 
-    void **current_pos = mem_heap_lo(); // Get entry to linked list
-    size_t size_act;
-    void *best_p = NULL;
-    size_t best_s = pow(16, SIZE_T_SIZE) - 1; // Max possible size (= worst)
-    
-    if (*current_pos != NULL){
-        
-        // If we have at least 1 element in the list, we go to it
-        current_pos = *((void **)current_pos);
-        
-
-        while (1){ // While we don't reach the end of the "forward" linked list
-            
-            //Find best fit
-            size_act = *(size_t *)moved_pointer(current_pos, 0, BLOCK_FORWARD, BLOCK_HEADER);
-
-            if (size_act > newsize && size_act < best_s){
-                
-                best_p = current_pos;
-                best_s = size_act;
-            }
-            else if (size_act == newsize){
-                
-                best_p = current_pos;
-                best_s = size_act;
-                break;
-            }
-            if(*((void **)current_pos) == NULL){
-                break;// that way, we make sure that whe we exit the loop, current_pos represents the last free block (to be used later!)
-            }
-            current_pos = *((void **)current_pos);
-            
-        }
+/*
+ * treap_join - Merges two trees, every block of left being below every block of right.
+ */
+static void *treap_join(void *left, void *right, int by_size){
+    if (left == NULL){
+        return right;
     }
+    if (right == NULL){
+        return left;
+    }
+    if (treap_priority(left) > treap_priority(right)){
+        set_link(left, TREE_LINK(by_size, LINK_RIGHT), treap_join(get_link(left, TREE_LINK(by_size, LINK_RIGHT)), right, by_size));
+        return left;
+    }
+    set_link(right, TREE_LINK(by_size, LINK_LEFT), treap_join(left, get_link(right, TREE_LINK(by_size, LINK_LEFT)), by_size));
+    return right;
+}
 
-    if (best_p == NULL){
-        // we extend only the amount we need
-        // Since we are adress ordered, if the last block is free then is is pointed by current_pos
-        void *p;
-        if (moved_pointer(current_pos,size_act,BLOCK_FORWARD,BLOCK_END) == (void*)((char*) mem_heap_hi()+1)){
-            
-            // In this case, the last pointer is a free block, we can increase by just the right amount!
-            mem_sbrk(newsize-size_act);
-            
-            void **before = (void **)moved_pointer(current_pos, 0, BLOCK_FORWARD, BLOCK_BACKWARD);
-            
-            if (*before!=NULL){
-    
-                *(void **)moved_pointer(*(void **)moved_pointer(current_pos, 0, BLOCK_FORWARD, BLOCK_BACKWARD), 0, BLOCK_BACKWARD, BLOCK_FORWARD) = NULL; // remove it from linked list
-            }
-            else{
-                *(void **)mem_heap_lo() = NULL;
-            }// no need to change the forward: it is the last pointer of the list!
-            
-            p = moved_pointer(current_pos,0,BLOCK_FORWARD,BLOCK_HEADER);
-           
+/*
+ * treap_insert - Inserts block in the tree rooted at node and returns the new root: we go down until a node of lower
+ * priority, and block takes its place with the two halves of its subtree as children.
+ */
+static void *treap_insert(void *node, void *block, int by_size){
+    if (node == NULL || treap_priority(block) > treap_priority(node)){
+        void *left, *right;
+        treap_split(node, block, &left, &right, by_size);
+        set_link(block, TREE_LINK(by_size, LINK_LEFT), left);
+        set_link(block, TREE_LINK(by_size, LINK_RIGHT), right);
+        return block;
+    }
+    int child = treap_less(block, node, by_size) ? LINK_LEFT : LINK_RIGHT;
+    set_link(node, TREE_LINK(by_size, child), treap_insert(get_link(node, TREE_LINK(by_size, child)), block, by_size));
+    return node;
+}
 
-        }else{
-            // The last one wasn't free
-            p = mem_sbrk(newsize);
-            
+/*
+ * treap_remove - Removes block from the tree rooted at node and returns the new root.
+ * In the size tree, the header of block must still hold the size it was inserted with.
+ */
+static void *treap_remove(void *node, void *block, int by_size){
+    if (node == block){
+        return treap_join(get_link(node, TREE_LINK(by_size, LINK_LEFT)), get_link(node, TREE_LINK(by_size, LINK_RIGHT)), by_size);
+    }
+    int child = treap_less(block, node, by_size) ? LINK_LEFT : LINK_RIGHT;
+    set_link(node, TREE_LINK(by_size, child), treap_remove(get_link(node, TREE_LINK(by_size, child)), block, by_size));
+    return node;
+}
+
+/*
+ * treap_contains - Is block in the tree rooted at node?
+ */
+static int treap_contains(void *node, void *block, int by_size){
+    while (node != NULL && node != block){
+        node = get_link(node, TREE_LINK(by_size, treap_less(block, node, by_size) ? LINK_LEFT : LINK_RIGHT));
+    }
+    return node != NULL;
+}
+
+#if !MM_SIZE_TREE
+/*
+ * treap_fit - In-order walk of the nodes at adresses in [lo, hi), giving them to the placement policy until it stops
+ * the walk (see fit_consider). Subtrees out of the bounds are skipped. returns 1 when the walk was stopped.
+ */
+static int treap_fit(void *node, void *lo, void *hi, size_t size, fit_t *fit){
+    while (node != NULL){
+        if (node < lo){
+            node = get_link(node, LINK_RIGHT);
+            continue;
         }
-        
-        if (p == (void *)-1){
-            printf("Unknown error when allocating a block\n");
-            return NULL;
-        }else {
-            
-            *(size_t *)p = newsize + 1;
-            return moved_pointer(p, newsize, BLOCK_HEADER, BLOCK_PAYLOAD);
+        if (node >= hi){
+            node = get_link(node, LINK_LEFT);
+            continue;
         }
-    }
-    // Best_p points the beginning of the payload
-    
-    // Else, split if necessary/possible | keep first part free so as not to change free list but just size
-    else{
-        if (best_s-newsize >= SIZE_T_SIZE + 2*sizeof(void *)){
-            // If splittable
-            
-            // Change header of free block
-            *((size_t*)moved_pointer(best_p, newsize, BLOCK_FORWARD, BLOCK_HEADER)) = best_s-newsize;
-            best_p = (void*)((char*)best_p + best_s-newsize); // Place at the beginning of the newly allocated HEADER
-        }
-        else{ 
-            // If not splittable
-            newsize = best_s; // Increase the size of the block to fill it
-
-            // Skip block in the "forward" linked list = first pointer
-            if (*((void **)moved_pointer(best_p, newsize, BLOCK_FORWARD, BLOCK_BACKWARD)) != NULL){
-                *(void**)moved_pointer(*((void **)moved_pointer(best_p, newsize, BLOCK_FORWARD, BLOCK_BACKWARD)), 0, BLOCK_BACKWARD, BLOCK_FORWARD) = *(void **)best_p;
-            }
-            else{
-                *(void **)mem_heap_lo() = *(void **)best_p;
-            }
-            // Skip block in the "backwards" linked list = second pointer
-            
-            if (*(void**)best_p != NULL){
-                *(void**)moved_pointer(*(void**)best_p, 0, BLOCK_FORWARD, BLOCK_BACKWARD) = *(void**)moved_pointer(best_p, newsize, BLOCK_FORWARD, BLOCK_BACKWARD);
-            }
+        if (treap_fit(get_link(node, LINK_LEFT), lo, hi, size, fit) || fit_consider(fit, node, size)){
+            return 1;
         }
-        // Now that the free block is done, set the allocated block metadata
-        *(size_t*)moved_pointer(best_p, newsize, BLOCK_FORWARD, BLOCK_HEADER) = newsize+1;
+        node = get_link(node, LINK_RIGHT);
     }
-    
-    // Finally, return the pointer to the block
-    return best_p;
+    return 0;
+}
+#endif
+
+static void index_insert(void *block, void *pred){
+#if MM_ADDR_TREE
+    ROOT->root = treap_insert(ROOT->root, block, TREE_BY_ADDR);
+#endif
+#if MM_SIZE_TREE
+    ROOT->size_root = treap_insert(ROOT->size_root, block, TREE_BY_SIZE);
+#endif
+}
+
+static void index_remove(void *block){
+#if MM_ADDR_TREE
+    ROOT->root = treap_remove(ROOT->root, block, TREE_BY_ADDR);
+#endif
+#if MM_SIZE_TREE
+    ROOT->size_root = treap_remove(ROOT->size_root, block, TREE_BY_SIZE);
+#endif
+}
+
+static void index_replace(void *old, void *new, size_t size){
+    // the priority depends on the adress, so new can't just take the links of old
+    index_remove(old);
+    set_header(new, size, 0);
+    index_insert(new, NULL);
+}
+
+static void index_resize(void *block, size_t size){
+#if MM_SIZE_TREE
+    ROOT->size_root = treap_remove(ROOT->size_root, block, TREE_BY_SIZE);
+    set_header(block, size, 0);
+    ROOT->size_root = treap_insert(ROOT->size_root, block, TREE_BY_SIZE);
+#else
+    // The tree is only ordered by adress, we just have to change the size
+    set_header(block, size, 0);
+#endif
 }
 
+#if MM_SIZE_TREE
 /*
- * mm_free - Frees the given pointer and coalesces free blocks on the right and on the left if possible.
- * preserves the adress ordering of the free blocks in the free list.
+ * index_find - Best fit in one descent of the size tree: the smallest (size, adress) at least as large as (size, 0),
+ * so ties go to the lowest adress, as with the list.
  */
-void mm_free(void *ptr)
-{
-    // ptr is at "BLOCK_FORWARD"
-    // Remove the allocated flags :
-    size_t free_size = *(size_t *)moved_pointer(ptr, 0, BLOCK_FORWARD, BLOCK_HEADER) & ~1;
-    
-    *(size_t *)moved_pointer(ptr, free_size, BLOCK_FORWARD, BLOCK_HEADER) = free_size;
-    
-
-    void **before_block = mem_heap_lo(); // Get first element of linked list
-    void **after_block;
-    short list_empty = 1;
-    
-    if (*before_block != NULL){
-        // If we have at least 1 element in the list
-        
-        // If this element is after pointer, add ptr between beginning and the block
-        if ((long unsigned int)*before_block > (long unsigned int) ptr){
-            // First add it
-            after_block = *before_block;
-            *(void**)before_block = ptr; // Before forward to self
-            *(void**)moved_pointer(after_block, 0, BLOCK_FORWARD, BLOCK_BACKWARD) = moved_pointer(ptr, 0, BLOCK_FORWARD, BLOCK_BACKWARD);// After backward to ptr backward
-            *((void **)ptr) = after_block;// Ptr forward to after forward
-            *((void**)moved_pointer(ptr, 0, BLOCK_FORWARD, BLOCK_BACKWARD)) = NULL; // Ptr backward to previous backward
-
-            // If coalescing possible with the block after:
-                // (we check that after_block header is ptr end)
-            if (moved_pointer(after_block, 0, BLOCK_FORWARD, BLOCK_HEADER) == moved_pointer(ptr, *(size_t *)moved_pointer(ptr, 0, BLOCK_FORWARD, BLOCK_HEADER), BLOCK_FORWARD, BLOCK_END)){
-                
-                // ptr gets bigger size
-                size_t new_block_size = *(size_t *)moved_pointer(ptr, 0, BLOCK_FORWARD, BLOCK_HEADER) + *(size_t *)moved_pointer(after_block, 0, BLOCK_FORWARD, BLOCK_HEADER);
-                *(size_t *)moved_pointer(ptr, 0, BLOCK_FORWARD, BLOCK_HEADER) = new_block_size;
-                
-                // skip after_block
-                *(void**)ptr = *(void**)after_block; // ptr forward = after forward
-                if (*(void**)ptr != NULL){
-                    // If there is a next (next) one, skip after_block in backwards list
-                    *(void**)moved_pointer(*(void**)ptr, 0, BLOCK_FORWARD, BLOCK_BACKWARD) = moved_pointer(ptr, 0, BLOCK_FORWARD, BLOCK_BACKWARD);
-                }
-            }
-            return;
-
-        }
-        // Otherwise, we go to it
-        before_block = *((void **)before_block);
-        
-        list_empty = 0;
-    }
-    
-    while (*before_block != NULL){ // While we don't reach the end of the "forward" linked list
-        // Wait until it's in between before_pos and *before_pos
-        
-        if ((long unsigned int)*before_block > (long unsigned int)ptr){
-            after_block = *before_block;
-
-            // First, just run normally :
-                // Add ptr between before and after block
-            *before_block = ptr;// Previous forward to ptr forward
-            *(void**)moved_pointer(after_block, 0, BLOCK_FORWARD, BLOCK_BACKWARD) = moved_pointer(ptr, 0, BLOCK_FORWARD, BLOCK_BACKWARD);// After backward to ptr backward
-            *((void **)ptr) = after_block;// Ptr forward to after forward
-            *((void**)moved_pointer(ptr, 0, BLOCK_FORWARD, BLOCK_BACKWARD)) = moved_pointer(before_block, 0, BLOCK_FORWARD, BLOCK_BACKWARD);// Ptr backward to previous backward
-
-            // If coalescing possible with the block before: (should not be possible to do it twice)
-                // (we check that ptr header is before_block end)
-            if (moved_pointer(ptr, 0, BLOCK_FORWARD, BLOCK_HEADER) == moved_pointer(before_block, *(size_t *)moved_pointer(before_block, 0, BLOCK_FORWARD, BLOCK_HEADER), BLOCK_FORWARD, BLOCK_END)){
-                
-                // before_block gets bigger size
-                size_t new_block_size = *(size_t *)moved_pointer(before_block, 0, BLOCK_FORWARD, BLOCK_HEADER) + *(size_t *)moved_pointer(ptr, 0, BLOCK_FORWARD, BLOCK_HEADER);
-                *(size_t *)moved_pointer(before_block, 0, BLOCK_FORWARD, BLOCK_HEADER) = new_block_size;
-                
-                // skip ptr
-                *(void**)before_block = after_block; // before forward = ptr forward = after_block
-                *(void**)moved_pointer(after_block, 0, BLOCK_FORWARD, BLOCK_BACKWARD) = moved_pointer(before_block, 0, BLOCK_FORWARD, BLOCK_BACKWARD);
-
-                // ptr "becomes" before_block for the next coalescing
-                ptr = before_block;
-            }
+static void *index_find(size_t size){
+    void *best_p = NULL;
+    void *pos = ROOT->size_root;
 
-            
-
-            // If coalescing possible with the block after: (should not be possible to do it twice)
-                // (we check that after_block header is ptr end)
-            if (moved_pointer(after_block, 0, BLOCK_FORWARD, BLOCK_HEADER) == moved_pointer(ptr, *(size_t *)moved_pointer(ptr, 0, BLOCK_FORWARD, BLOCK_HEADER), BLOCK_FORWARD, BLOCK_END)){
-                
-                // ptr gets bigger size
-                size_t size_new_block = *(size_t *)moved_pointer(ptr, 0, BLOCK_FORWARD, BLOCK_HEADER) + *(size_t *)moved_pointer(after_block, 0, BLOCK_FORWARD, BLOCK_HEADER);
-                *(size_t *)moved_pointer(ptr, 0, BLOCK_FORWARD, BLOCK_HEADER) = size_new_block;
-                
-                // skip after_block
-                *(void**)ptr = *(void**)after_block; // ptr forward = after forward
-                if (*(void**)ptr != NULL){
-                    
-                    // If there is a next (next) one, skip after_block in backwards list
-                    *(void**)moved_pointer(*(void**)ptr, 0, BLOCK_FORWARD, BLOCK_BACKWARD) = moved_pointer(ptr, 0, BLOCK_FORWARD, BLOCK_BACKWARD);
-                }
-            }
-            return;
+    while (pos != NULL){
+        STAT_ADD(visited, 1);
+        if (GET_SIZE(pos) >= size){
+            best_p = pos;
+            pos = get_link(pos, TREE_LINK(TREE_BY_SIZE, LINK_LEFT));
+        } else {
+            pos = get_link(pos, TREE_LINK(TREE_BY_SIZE, LINK_RIGHT));
         }
-        before_block = *((void **)before_block);
     }
-    
-
-    
-    // If never reached, add to the end of the list
-    
-    if (list_empty){
-        *before_block = ptr;// Previous forward to ptr forward
-        *(void **)moved_pointer(ptr, 0, BLOCK_FORWARD, BLOCK_BACKWARD) = NULL;// Ptr backward to NULL
-    } else{
-        // If we can coalesce with before
-        if (moved_pointer(ptr, 0, BLOCK_FORWARD, BLOCK_HEADER) == moved_pointer(before_block, *(size_t *)moved_pointer(before_block, 0, BLOCK_FORWARD, BLOCK_HEADER), BLOCK_FORWARD, BLOCK_END)){
-                // before_block gets bigger size
-                size_t new_block_size = *(size_t *)moved_pointer(before_block, 0, BLOCK_FORWARD, BLOCK_HEADER) + *(size_t *)moved_pointer(ptr, 0, BLOCK_FORWARD, BLOCK_HEADER);
-                *(size_t *)moved_pointer(before_block, 0, BLOCK_FORWARD, BLOCK_HEADER) = new_block_size;
-    
-                // skip ptr
-                *(void**)before_block = NULL; // before forward = ptr forward = NULL
-
-                // ptr "becomes" before_block for the next coalescing
-                ptr = before_block;
-            }
-        else{
-            *before_block = ptr;// Previous forward to ptr forward
-            *(void **)moved_pointer(ptr, 0, BLOCK_FORWARD, BLOCK_BACKWARD) = moved_pointer(before_block, 0, BLOCK_FORWARD, BLOCK_BACKWARD);
-        }
+    return best_p;
+}
+#else
+/*
+ * index_find - Walks the tree in adress order with the placement policy (see fit_consider). With best fit, returns the
+ * smallest free block large enough, the one with the lowest adress in case of ties.
+ * Next fit walks from the adress of the last block found to the end, then from the beginning.
+ */
+static void *index_find(size_t size){
+    fit_t fit = {NULL, 0, 0};
+#if MM_PLACEMENT == MM_PLACE_NEXT
+    if (!treap_fit(ROOT->root, ROOT->rover, (void *)UINTPTR_MAX, size, &fit)){
+        treap_fit(ROOT->root, NULL, ROOT->rover, size, &fit);
     }
-    *((void **)ptr) = NULL;// Ptr forward to NULL
-    
-    return;
+    ROOT->rover = fit.best_p;
+#else
+    treap_fit(ROOT->root, NULL, (void *)UINTPTR_MAX, size, &fit);
+#endif
+    return fit.best_p;
 }
+#endif
 
+#if MM_STATS
+#if MM_SIZE_TREE
 /*
- * mm_realloc - reallocs a block pointed by ptr to a size given by asked_size. returns a pointer to the adress of the new block.
- * Calling with ptr==NULL is equivalent to a call to malloc. Calling with asked_size=0 and ptr!=NULL is equivalent to free.
- * 
- *  - Does not realloc if asked_size is less or equal then the current block size.
- *  - Directly extends the block if there is a free block after it. If possible, split it into the allocated part and a new, smaller free block.
- *  - If ptr points to the last block of the heap, extends the heap by the just right amount and keep the ptr adress.
- *  - IF all the above fail, we default to a call to malloc and free.
- * 
+ * index_largest - Returns the size of the largest free block, 0 if there is none: the rightmost node of the size tree.
  */
-void *mm_realloc(void *ptr, size_t asked_size)
-{
-    
-    // dealing with degenerate cases
-    if(ptr==NULL){
-        
-        return mm_malloc(asked_size);
+static size_t index_largest(void){
+    void *pos = ROOT->size_root;
+    if (pos == NULL){
+        return 0;
     }
-    if(asked_size==0){
-        
-        mm_free(ptr);
-        return ptr;
+    while (get_link(pos, TREE_LINK(TREE_BY_SIZE, LINK_RIGHT)) != NULL){
+        pos = get_link(pos, TREE_LINK(TREE_BY_SIZE, LINK_RIGHT));
     }
+    return GET_SIZE(pos);
+}
+#else
+/*
+ * treap_largest - Returns the size of the largest node of the adress tree rooted at node. Visits every node.
+ */
+static size_t treap_largest(void *node){
+    size_t largest = 0;
+    while (node != NULL){
+        size_t left = treap_largest(get_link(node, LINK_LEFT));
+        if (left > largest){
+            largest = left;
+        }
+        if (GET_SIZE(node) > largest){
+            largest = GET_SIZE(node);
+        }
+        node = get_link(node, LINK_RIGHT);
+    }
+    return largest;
+}
+
+static size_t index_largest(void){
+    return treap_largest(ROOT->root);
+}
+#endif
+#endif
+
+#if MM_ADDR_TREE && !BOUNDARY_TAGS
+/*
+ * index_prev - Descent of the tree, keeping the last node on the left of block.
+ */
+static void *index_prev(void *block){
+    void *pred = NULL;
+    void *pos = ROOT->root;
+
+    while (pos != NULL){
+        if (pos < block){
+            pred = pos;
+            pos = get_link(pos, LINK_RIGHT);
+        } else {
+            pos = get_link(pos, LINK_LEFT);
+        }
+    }
+    return pred;
+}
+
+static void *index_last(void){
+    void *pos = ROOT->root;
+    if (pos == NULL){
+        return NULL;
+    }
+    while (get_link(pos, LINK_RIGHT) != NULL){
+        pos = get_link(pos, LINK_RIGHT);
+    }
+    return pos;
+}
+#endif
+
+#else
+
+#if MM_PACKED_INDEX
+/*
+ * The packed index mirrors the list in two arrays, mapped with memlib: packed_sizes[i] is the size of the free block at
+ * packed_blocks[i], in adress order. A free block costs a memmove in the arrays, but best fit reads the sizes only, one
+ * vector of PACKED_LANES at a time (the vector extensions of gcc give AVX2 or SSE code when enabled, scalar code
+ * otherwise), instead of a dependent load per block of the list. If an array can't grow, the packed index is dropped.
+ */
+#define PACKED_LANES    4
+#define PACKED_STRIDE   64  // entries scanned between checks for a perfect fit
+typedef size_t size_vec_t __attribute__((vector_size(PACKED_LANES * sizeof(size_t))));
+
+/*
+ * packed_pos - Returns the position of block in the arrays, or of the first block above it. Binary search.
+ */
+static size_t packed_pos(void *block){
+    size_t lo = 0;
+    size_t hi = ROOT->packed_count;
+    while (lo < hi){
+        size_t mid = lo + (hi - lo) / 2;
+        if ((char *)ROOT->packed_blocks[mid] < (char *)block){
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void packed_drop(void){
+    if (ROOT->packed_sizes != NULL){
+        mem_unmap(ROOT->packed_sizes);
+    }
+    if (ROOT->packed_blocks != NULL){
+        mem_unmap(ROOT->packed_blocks);
+    }
+    ROOT->packed_sizes = NULL;
+    ROOT->packed_blocks = NULL;
+    ROOT->packed_failed = 1;
+}
+
+/*
+ * packed_grow - Maps the arrays with a page each, or doubles them. returns 0 if they could not grow.
+ */
+static int packed_grow(void){
+    size_t room = (ROOT->packed_room == 0) ? mem_pagesize() / sizeof(size_t) : 2 * ROOT->packed_room;
+    void *sizes, *blocks;
+
+    if (ROOT->packed_room == 0){
+        sizes = mem_map(room * sizeof(size_t));
+        blocks = mem_map(room * sizeof(void *));
+    } else {
+        sizes = mem_remap(ROOT->packed_sizes, room * sizeof(size_t));
+        if (sizes != NULL){
+            ROOT->packed_sizes = sizes;
+        }
+        blocks = mem_remap(ROOT->packed_blocks, room * sizeof(void *));
+        if (blocks != NULL){
+            ROOT->packed_blocks = blocks;
+        }
+    }
+    if (ROOT->packed_room == 0){
+        ROOT->packed_sizes = sizes;
+        ROOT->packed_blocks = blocks;
+    }
+    if (sizes == NULL || blocks == NULL){
+        return 0;
+    }
+    ROOT->packed_room = room;
+    return 1;
+}
+
+static void packed_insert(void *block){
+    if (ROOT->packed_failed){
+        return;
+    }
+    if (ROOT->packed_count == ROOT->packed_room && !packed_grow()){
+        packed_drop();
+        return;
+    }
+    size_t pos = packed_pos(block);
+    size_t after = ROOT->packed_count - pos;
+    memmove(&ROOT->packed_sizes[pos + 1], &ROOT->packed_sizes[pos], after * sizeof(size_t));
+    memmove(&ROOT->packed_blocks[pos + 1], &ROOT->packed_blocks[pos], after * sizeof(void *));
+    ROOT->packed_sizes[pos] = GET_SIZE(block);
+    ROOT->packed_blocks[pos] = block;
+    ROOT->packed_count++;
+}
+
+static void packed_remove(void *block){
+    if (ROOT->packed_failed){
+        return;
+    }
+    size_t pos = packed_pos(block);
+    size_t after = ROOT->packed_count - pos - 1;
+    memmove(&ROOT->packed_sizes[pos], &ROOT->packed_sizes[pos + 1], after * sizeof(size_t));
+    memmove(&ROOT->packed_blocks[pos], &ROOT->packed_blocks[pos + 1], after * sizeof(void *));
+    ROOT->packed_count--;
+}
+
+/*
+ * packed_replace - new, in the same gap between allocated blocks as old, takes its place with size bytes.
+ */
+static void packed_replace(void *old, void *new, size_t size){
+    if (ROOT->packed_failed){
+        return;
+    }
+    size_t pos = packed_pos(old);
+    ROOT->packed_sizes[pos] = size;
+    ROOT->packed_blocks[pos] = new;
+}
+
+/*
+ * packed_find - Best fit over the sizes: the smallest one of at least size bytes, the first one in case of ties as with
+ * the list. Sizes too small are turned into SIZE_MAX with the comparison mask, then each lane keeps its minimum and
+ * where it first saw it. After every stride, a lane holding a perfect fit ends the search; the last entries that don't
+ * fill a vector are scanned one by one.
+ */
+static void *packed_find(size_t size){
+    const size_t *sizes = ROOT->packed_sizes;
+    size_t count = ROOT->packed_count;
+    size_vec_t best = (size_vec_t){0} - 1;
+    size_vec_t best_at = (size_vec_t){0};
+    size_vec_t at;
+    size_vec_t too_small = (size_vec_t){0} + (size - 1);
+    size_t best_s = (size_t)-1, best_i = 0, i = 0;
+
+    for (int lane = 0; lane < PACKED_LANES; lane++){
+        at[lane] = lane;
+    }
+    while (i + PACKED_LANES <= count){
+        size_t end = (i + PACKED_STRIDE < count) ? i + PACKED_STRIDE : count;
+        for (; i + PACKED_LANES <= end; i += PACKED_LANES, at += PACKED_LANES){
+            size_vec_t v;
+            memcpy(&v, &sizes[i], sizeof(v));
+            v |= (size_vec_t)(v <= too_small);
+            size_vec_t smaller = (size_vec_t)(v < best);
+            best = (v & smaller) | (best & ~smaller);
+            best_at = (at & smaller) | (best_at & ~smaller);
+        }
+        // nothing beats a perfect fit, and the first one is where one of the lanes first saw it
+        size_t first = count;
+        for (int lane = 0; lane < PACKED_LANES; lane++){
+            if (best[lane] == size && best_at[lane] < first){
+                first = best_at[lane];
+            }
+        }
+        if (first < count){
+            STAT_ADD(visited, i);
+            return ROOT->packed_blocks[first];
+        }
+    }
+    for (int lane = 0; lane < PACKED_LANES; lane++){
+        if (best[lane] < best_s || (best[lane] == best_s && best_at[lane] < best_i)){
+            best_s = best[lane];
+            best_i = best_at[lane];
+        }
+    }
+    for (; i < count; i++){
+        if (sizes[i] >= size && sizes[i] < best_s){
+            best_s = sizes[i];
+            best_i = i;
+            if (best_s == size){
+                i++;
+                break;
+            }
+        }
+    }
+    STAT_ADD(visited, i);
+    if (best_s == (size_t)-1){
+        return NULL;
+    }
+    return ROOT->packed_blocks[best_i];
+}
+#endif
+
+static void index_insert(void *block, void *pred){
+    void *succ = (pred == NULL) ? ROOT->head : get_link(pred, LINK_NEXT);
+
+    set_link(block, LINK_NEXT, succ);
+    set_link(block, LINK_PREV, pred);
+    if (pred != NULL){
+        set_link(pred, LINK_NEXT, block);
+    } else {
+        ROOT->head = block;
+    }
+    if (succ != NULL){
+        set_link(succ, LINK_PREV, block);
+    } else {
+        ROOT->tail = block;
+    }
+#if MM_PACKED_INDEX
+    packed_insert(block);
+#endif
+}
+
+static void index_remove(void *block){
+    void *next = get_link(block, LINK_NEXT);
+    void *prev = get_link(block, LINK_PREV);
+
+    if (prev != NULL){
+        set_link(prev, LINK_NEXT, next);
+    } else {
+        ROOT->head = next;
+    }
+    if (next != NULL){
+        set_link(next, LINK_PREV, prev);
+    } else {
+        ROOT->tail = prev;
+    }
+#if MM_PACKED_INDEX
+    packed_remove(block);
+#endif
+#if MM_PLACEMENT == MM_PLACE_NEXT
+    // the rover must stay in the list
+    if (ROOT->rover == block){
+        ROOT->rover = next;
+    }
+#endif
+}
+
+static void index_replace(void *old, void *new, size_t size){
+    // new is in the same gap as old, so the adress order is preserved by just taking its links
+    void *next = get_link(old, LINK_NEXT);
+    void *prev = get_link(old, LINK_PREV);
+
+    set_header(new, size, 0);
+    set_link(new, LINK_NEXT, next);
+    set_link(new, LINK_PREV, prev);
+    if (prev != NULL){
+        set_link(prev, LINK_NEXT, new);
+    } else {
+        ROOT->head = new;
+    }
+    if (next != NULL){
+        set_link(next, LINK_PREV, new);
+    } else {
+        ROOT->tail = new;
+    }
+#if MM_PACKED_INDEX
+    packed_replace(old, new, size);
+#endif
+#if MM_PLACEMENT == MM_PLACE_NEXT
+    if (ROOT->rover == old){
+        ROOT->rover = new;
+    }
+#endif
+}
+
+static void index_resize(void *block, size_t size){
+    // The list is only ordered by adress, we just have to change the size
+    set_header(block, size, 0);
+#if MM_PACKED_INDEX
+    packed_replace(block, block, size);
+#endif
+}
+
+/*
+ * index_find - Walks the list with the placement policy (see fit_consider). With best fit, returns the smallest free block
+ * large enough, the one with the lowest adress in case of ties.
+ * Next fit walks from the last block found (the rover, kept in the list by index_remove) to the end, then from the head.
+ * The packed index gives the same block, see packed_find.
+ */
+static void *index_find(size_t size){
+    fit_t fit = {NULL, 0, 0};
+#if MM_PACKED_INDEX
+    if (!ROOT->packed_failed){
+        return packed_find(size);
+    }
+#endif
+#if MM_PLACEMENT == MM_PLACE_NEXT
+    void *start = (ROOT->rover != NULL) ? ROOT->rover : ROOT->head;
+    void *block;
+
+    for (block = start; block != NULL; block = get_link(block, LINK_NEXT)){
+        if (fit_consider(&fit, block, size)){
+            break;
+        }
+    }
+    for (block = ROOT->head; block != start && fit.best_p == NULL; block = get_link(block, LINK_NEXT)){
+        if (fit_consider(&fit, block, size)){
+            break;
+        }
+    }
+    ROOT->rover = fit.best_p;
+#else
+    for (void *block = ROOT->head; block != NULL; block = get_link(block, LINK_NEXT)){
+        if (fit_consider(&fit, block, size)){
+            break;
+        }
+    }
+#endif
+    return fit.best_p;
+}
+
+/*
+ * index_prev - Walks the list until the first free block after block. Linear cost, logarithmic with the packed index.
+ */
+static void *index_prev(void *block){
+    void *pred = NULL;
+    void *pos = ROOT->head;
+#if MM_PACKED_INDEX
+    if (!ROOT->packed_failed){
+        size_t i = packed_pos(block);
+        return (i == 0) ? NULL : ROOT->packed_blocks[i - 1];
+    }
+#endif
+
+    while (pos != NULL && pos < block){
+        pred = pos;
+        pos = get_link(pos, LINK_NEXT);
+    }
+    return pred;
+}
+
+#if !BOUNDARY_TAGS
+static void *index_last(void){
+    return ROOT->tail;
+}
+#endif
+
+#if MM_STATS
+/*
+ * index_largest - Returns the size of the largest free block, 0 if there is none. Walks the list.
+ */
+static size_t index_largest(void){
+    size_t largest = 0;
+    for (void *block = ROOT->head; block != NULL; block = get_link(block, LINK_NEXT)){
+        if (GET_SIZE(block) > largest){
+            largest = GET_SIZE(block);
+        }
+    }
+    return largest;
+}
+#endif
+
+#endif
+
+/*
+ * last_free_block - Returns the last block of the heap if it is free, NULL otherwise.
+ */
+static void *last_free_block(void){
+#if BOUNDARY_TAGS
+    return left_free_block(HEAP_END);
+#else
+    void *last = index_last();
+    if (last != NULL && moved_pointer(last, GET_SIZE(last), BLOCK_HEADER, BLOCK_END) == HEAP_END){
+        return last;
+    }
+    return NULL;
+#endif
+}
+
+// debug functions
+
+#if MM_TLSF
+/*
+ * free_list_debug - Prints in a readable way every size class list, and performs cheks along the way:
+ *  - Do the bitmaps match the lists that are empty or not?
+ *  - Is each free block actually flagged as free, and in the list of its size class?
+ *  - Is the bachward pointer indeed pointing toward the previous element of the list?
+ *  - Are there contiguous free blocks that escaped coalescing? (checked with the header of the next block)
+ *
+ * verbose = 1 will print, verbose = 0 will only check.
+ * returns 1 if everything went well, otherwise print error message and returns 0.
+ */
+int free_list_debug(int verbose){
+    if(verbose)printf("\n___FREE LISTS:___\n");
+
+    if (HEAP_SIZE() == 0){
+        return 1;
+    }
+
+    for (int fl = 0; fl < TLSF_FL_COUNT; fl++){
+        if (((ROOT->fl_map >> fl) & 1) != (ROOT->sl_map[fl] != 0)){
+            printf("   First level bitmap is WRONG for class %d\n", fl);
+            return 0;
+        }
+        for (int sl = 0; sl < TLSF_SL_COUNT; sl++){
+            void *pos = ROOT->heads[fl][sl];
+            void *prevpos = NULL;
+
+            if (((ROOT->sl_map[fl] >> sl) & 1) != (pos != NULL)){
+                printf("   Second level bitmap is WRONG for class %d,%d\n", fl, sl);
+                return 0;
+            }
+            if(verbose && pos != NULL)printf("  Class %d,%d:\n", fl, sl);
+
+            while (pos != NULL){
+                size_t size = *(size_t *)pos;
+                int pos_fl, pos_sl;
+                if(verbose){
+                    printf("   Position : %p\n", pos);
+                    printf("   Forward  : %p\n", get_link(pos, LINK_NEXT));
+                    printf("   Backward : %p\n", get_link(pos, LINK_PREV));
+                    printf("   Header : %zu\n", size);
+                }
+
+                //is the backward link indeed pointing towards the previous element?
+                if (get_link(pos, LINK_PREV) != prevpos){
+                    printf("   Backwards pointer is WRONG \n");
+                    return 0;
+                }
+
+                // is every block of the list free?
+                if(size & ALLOC_FLAG){
+                    printf("   The block is not flagged as free\n");
+                    return 0;
+                }
+
+                // is it in the right class?
+                tlsf_mapping(GET_SIZE(pos), &pos_fl, &pos_sl);
+                if (pos_fl != fl || pos_sl != sl){
+                    printf("   The block is not in the list of its size class\n");
+                    return 0;
+                }
+
+                // Did the free blocks escape coalescing?
+                void *next = moved_pointer(pos, GET_SIZE(pos), BLOCK_HEADER, BLOCK_END);
+                if (next != HEAP_END && !IS_ALLOC(next)){
+                    printf("   The block escaped coalescing with the next one\n");
+                    return 0;
+                }
+                prevpos = pos;
+                pos = get_link(pos, LINK_NEXT);
+            }
+        }
+    }
+    return 1;
+}
+
+/*
+ * index_contains - Is block in the list of its size class?
+ */
+static int index_contains(void *block){
+    int fl, sl;
+    tlsf_mapping(GET_SIZE(block), &fl, &sl);
+    for (void *pos = ROOT->heads[fl][sl]; pos != NULL; pos = get_link(pos, LINK_NEXT)){
+        if (pos == block){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+#elif MM_ADDR_TREE || MM_SIZE_TREE
+/*
+ * treap_debug - In-order walk of the subtree at node, whose blocks must lie strictly between lo and hi (NULL when unbounded).
+ * prevpos is the last free block visited, to check coalescing in the adress tree. count is incremented for every node.
+ * See free_list_debug.
+ */
+static int treap_debug(void *node, void *lo, void *hi, void **prevpos, size_t *count, int by_size, int verbose){
+    if (node == NULL){
+        return 1;
+    }
+    void *left = get_link(node, TREE_LINK(by_size, LINK_LEFT));
+    void *right = get_link(node, TREE_LINK(by_size, LINK_RIGHT));
+
+    if (!treap_debug(left, lo, node, prevpos, count, by_size, verbose)){
+        return 0;
+    }
+    size_t size = *(size_t *)node;
+    if(verbose){
+        printf("   Position : %p\n", node);
+        printf("   Left  : %p\n", left);
+        printf("   Right : %p\n", right);
+        printf("   Header : %zu\n", size);
+    }
+    (*count)++;
+
+    // is the node in the right subtree?
+    if ((lo != NULL && !treap_less(lo, node, by_size)) || (hi != NULL && !treap_less(node, hi, by_size))){
+        printf("   The blocks are not well ordered\n");
+        return 0;
+    }
+
+    // is the tree a heap of priorities?
+    if ((left != NULL && treap_priority(left) > treap_priority(node)) || (right != NULL && treap_priority(right) > treap_priority(node))){
+        printf("   The priorities are not a heap\n");
+        return 0;
+    }
+
+    // is every block of the tree free?
+    if(size & ALLOC_FLAG){
+        printf("   The block is not flagged as free\n");
+        return 0;
+    }
+
+    // Did the free blocks escape coalescing?
+    void *next = moved_pointer(node, GET_SIZE(node), BLOCK_HEADER, BLOCK_END);
+    if(next != HEAP_END && !IS_ALLOC(next)){
+        printf("   The block escaped coalescing with the next one\n");
+        return 0;
+    }
+    if(!by_size && *prevpos != NULL && moved_pointer(*prevpos,GET_SIZE(*prevpos),BLOCK_HEADER,BLOCK_END) == node){
+        printf("   The two last blocks escaped coalescing\n");
+        return 0;
+    }
+    *prevpos = node;
+    return treap_debug(right, node, hi, prevpos, count, by_size, verbose);
+}
+
+/*
+ * free_list_debug - Prints in a readable way the free trees in order, and performs cheks along the way:
+ *  - Is each free block actually flagged as free?
+ *  - Are the blocks well ordered in the trees, and the priorities a heap?
+ *  - Are there contiguous free blocks that escaped coalescing?
+ *  - Do the two trees (if both are used) hold the same number of blocks?
+ *
+ * verbose = 1 will print, verbose = 0 will only check.
+ * returns 1 if everything went well, otherwise print error message and returns 0.
+ */
+int free_list_debug(int verbose){
+    if (HEAP_SIZE() == 0){
+        return 1;
+    }
+
+    void *prevpos = NULL;
+    size_t count[2] = {0, 0}; // number of blocks in the adress and size trees
+#if MM_ADDR_TREE
+    if(verbose)printf("\n___FREE TREE BY ADRESS:___\n");
+    if (!treap_debug(ROOT->root, NULL, NULL, &prevpos, &count[TREE_BY_ADDR], TREE_BY_ADDR, verbose)){
+        return 0;
+    }
+#endif
+#if MM_SIZE_TREE
+    if(verbose)printf("\n___FREE TREE BY SIZE:___\n");
+    prevpos = NULL;
+    if (!treap_debug(ROOT->size_root, NULL, NULL, &prevpos, &count[TREE_BY_SIZE], TREE_BY_SIZE, verbose)){
+        return 0;
+    }
+#endif
+#if MM_ADDR_TREE && MM_SIZE_TREE
+    if (count[TREE_BY_ADDR] != count[TREE_BY_SIZE]){
+        printf("   The two trees don't hold the same blocks\n");
+        return 0;
+    }
+#endif
+    return 1;
+}
+
+/*
+ * index_contains - Is block in the trees?
+ */
+static int index_contains(void *block){
+#if MM_ADDR_TREE
+    if (!treap_contains(ROOT->root, block, TREE_BY_ADDR)){
+        return 0;
+    }
+#endif
+#if MM_SIZE_TREE
+    if (!treap_contains(ROOT->size_root, block, TREE_BY_SIZE)){
+        return 0;
+    }
+#endif
+    return 1;
+}
+
+#else
+/*
+ * free_list_debug - Prints in a readable way the free list, and performs cheks along the way:
+ *  - Is each free block actually flagged as free?
+ *  - Is the bachward pointer indeed pointing toward the previous element of the list?
+ *  - Are the adresses well ordered in the list? (We rely on an adress-ordered free list to optimize some parts of the code)
+ *  - Are there contiguous free blocks that escaped coalescing?
+ *
+ * verbose = 1 will print, verbose = 0 will only check.
+ * returns 1 if everything went well, otherwise print error message and returns 0.
+ */
+int free_list_debug(int verbose){
+    if(verbose)printf("\n___FREE LIST:___\n");
+
+    if (HEAP_SIZE() == 0){
+        return 1;
+    }
+
+    void *pos = ROOT->head;
+    void *prevpos = NULL;
+    size_t size = 0;
+    size_t prevsize = 0;
+
+    while (pos!=NULL){
+        size = *(size_t *)pos;
+        if(verbose){
+            printf("   Position : %p\n", pos);
+            printf("   Forward  : %p\n", get_link(pos, LINK_NEXT));
+            printf("   Backward : %p\n", get_link(pos, LINK_PREV));
+            printf("   Header : %zu\n", size);
+        }
+
+        // some sanity checks
+
+        //is the backward link indeed pointing towards the previous element?
+        if (get_link(pos, LINK_PREV) != prevpos){
+            printf("   Backwards pointer is WRONG \n");
+            return 0;
+        }
+
+        // is every block of the list free?
+
+        if(size & ALLOC_FLAG){
+            printf("   The block is not flagged as free\n");
+            return 0;
+        }
+
+        // are the adresses in increasing order?
+
+        if(prevpos != NULL && pos <= prevpos){
+            printf("   The adresses are not well ordered\n");
+            return 0;
+        }
+
+        // Did the free blocks escape coalescing?
+
+        if(prevpos!=NULL && moved_pointer(prevpos,prevsize,BLOCK_HEADER,BLOCK_END) == pos){
+            printf("   The two last blocks escaped coalescing\n");
+            return 0;
+        }
+        prevpos = pos;
+        prevsize = GET_SIZE(pos);
+        // follow linked list
+        pos = get_link(pos, LINK_NEXT);
+    }
+
+    if (ROOT->tail != prevpos){
+        printf("   The tail of the list is WRONG\n");
+        return 0;
+    }
+#if MM_PACKED_INDEX
+    // does the packed index mirror the list?
+    if (!ROOT->packed_failed){
+        size_t i = 0;
+        for (pos = ROOT->head; pos != NULL; pos = get_link(pos, LINK_NEXT), i++){
+            if (i >= ROOT->packed_count || ROOT->packed_blocks[i] != pos || ROOT->packed_sizes[i] != GET_SIZE(pos)){
+                printf("   The packed index is WRONG at entry %zu\n", i);
+                return 0;
+            }
+        }
+        if (i != ROOT->packed_count){
+            printf("   The packed index has %zu entries for %zu free blocks\n", ROOT->packed_count, i);
+            return 0;
+        }
+    }
+#endif
+    return 1;
+}
+#endif
+
+/*
+ * print_heap_blocks - Prints in a readable way the whole heap as it is and its boundaries,
+ * and cheks along the way if every free block is in the free list.
+ * With boundary tags, also checks the footer of every free block and the PREV_FREE flag of the block after it.
+ *
+ * if verbose = 1, it will print. If verbose = 0, it will only check.
+ * returns 1 if everything went well, otherwise print error message and returns 0.
+ */
+int print_heap_blocks(int verbose){
+
+    if(verbose){
+        printf("\n___HEAP BLOCKS PRINT___\n");
+        printf("First block is after the free block index\n  pos = %p \n",HEAP_LO());
+    }
+
+    if(HEAP_SIZE()==0){
+        if(verbose)printf("empty\n");
+        return 1;
+    }
+
+    void *pos = FIRST_BLOCK;
+    void *end_of_heap = HEAP_END;
+#if ADDR_ORDERED && !MM_ADDR_TREE
+    void* next_free_block = ROOT->head;
+#endif
+#if BOUNDARY_TAGS
+    size_t prev_free = 0;
+#endif
+
+    if(verbose)printf("Start of heap.\n");
+
+    //we jump from blocks to blocks untill we reach the heap boundary
+    while (pos!=end_of_heap){
+
+        if(verbose)printf("\nblock at adress %p :\n",pos);
+        size_t current_size_header = *(size_t *)pos;
+
+#if BOUNDARY_TAGS
+        // Does the PREV_FREE flag match the block before?
+        if ((current_size_header & PREV_FREE_FLAG) != prev_free){
+            printf("  PREV_FREE flag is wrong!\n");
+            return 0;
+        }
+        prev_free = IS_ALLOC(pos) ? 0 : PREV_FREE_FLAG;
+#endif
+
+        // is the block allocated? Use flag stored in first bit of size to know
+        if(IS_ALLOC(pos)){
+            if(verbose)printf("  allocated\n");
+        }else{
+            if(verbose)printf("  free block \n");
+#if ADDR_ORDERED && !MM_ADDR_TREE
+            // Does this adress corresponds to the one indicated by the last forward pointer of the linked list?
+            if(next_free_block!=pos){
+                printf("  free block not in free list!\n");
+                return 0;
+            }
+            //follow the linked list
+            next_free_block = get_link(pos, LINK_NEXT);
+#else
+            if(!index_contains(pos)){
+                printf("  free block not in free list!\n");
+                return 0;
+            }
+#endif
+#if BOUNDARY_TAGS
+            if(*(size_t *)((char *)pos + GET_SIZE(pos) - SIZE_T_SIZE) != GET_SIZE(pos)){
+                printf("  footer does not match the header!\n");
+                return 0;
+            }
+#endif
+        }
+
+        if(verbose)printf("  size = %zu\n",current_size_header);
+        if(GET_SIZE(pos) < MIN_BLOCK_SIZE || GET_SIZE(pos) > (size_t)((char *)end_of_heap - (char *)pos)){
+            printf("  block size is out of bounds!\n");
+            return 0;
+        }
+        // jump size bytes ahead. GET_SIZE to get true size without the flags.
+        pos = moved_pointer(pos,GET_SIZE(pos),BLOCK_HEADER,BLOCK_END);
+    }
+#if BOUNDARY_TAGS
+    if ((ROOT->epilogue & PREV_FREE_FLAG) != prev_free){
+        printf("  PREV_FREE flag of the epilogue is wrong!\n");
+        return 0;
+    }
+#endif
+    if(verbose)printf("end of heap: %p\n",HEAP_HI());
+    return 1;
+}
+
+#if MM_SLABS
+static int slab_debug(int verbose);
+static slab_t *slab_of(void *ptr);
+#else
+#define slab_debug(verbose) 1
+#endif
+
+#if MM_DEFERRED_FREE
+/*
+ * pending_debug - Checks that every pending block is the header of an allocated block of the heap, and is pending only once.
+ * if verbose = 1, also prints the number of pending blocks.
+ */
+static int pending_debug(int verbose){
+    if (HEAP_SIZE() == 0){
+        return 1;
+    }
+    unsigned int found = 0;
+    void *pos = FIRST_BLOCK;
+    // the heap was checked by print_heap_blocks, but we stop on a broken block anyway
+    while (pos < HEAP_END && GET_SIZE(pos) >= MIN_BLOCK_SIZE){
+        for (unsigned int i = 0; i < ROOT->pending_count; i++){
+            if (ROOT->pending[i] == pos){
+                if (!IS_ALLOC(pos)){
+                    printf("  pending block is marked free!\n");
+                    return 0;
+                }
+                found++;
+            }
+        }
+        pos = moved_pointer(pos, GET_SIZE(pos), BLOCK_HEADER, BLOCK_END);
+    }
+    if (found != ROOT->pending_count){
+        printf("  pending block is not a block of the heap, or pending twice!\n");
+        return 0;
+    }
+    if (verbose)printf("%u pending blocks\n", ROOT->pending_count);
+    return 1;
+}
+#else
+#define pending_debug(verbose) 1
+#endif
+
+#if MM_QUICK_CACHE
+/*
+ * quick_debug - Checks that the lists of the quick cache have the length of their count, at most MM_QUICK_CACHE, and that
+ * their blocks are allocated blocks of the heap of the size of the class, each cached only once.
+ * if verbose = 1, also prints the number of cached blocks.
+ */
+static int quick_debug(int verbose){
+    if (HEAP_SIZE() == 0){
+        return 1;
+    }
+    unsigned int cached = 0;
+    for (unsigned int class = 0; class < QUICK_CLASSES; class++){
+        unsigned int length = 0;
+        for (void *block = ROOT->quick[class]; block != NULL && length <= MM_QUICK_CACHE; block = get_link(block, LINK_NEXT)){
+            length++;
+        }
+        if (length != ROOT->quick_count[class] || length > MM_QUICK_CACHE){
+            printf("  quick cache list does not match its count!\n");
+            return 0;
+        }
+        cached += length;
+    }
+
+    unsigned int found = 0;
+    void *pos = FIRST_BLOCK;
+    // the heap was checked by print_heap_blocks, but we stop on a broken block anyway
+    while (pos < HEAP_END && GET_SIZE(pos) >= MIN_BLOCK_SIZE){
+        size_t size = GET_SIZE(pos);
+        if (size <= QUICK_MAX_BLOCK){
+            for (void *block = ROOT->quick[QUICK_CLASS(size)]; block != NULL; block = get_link(block, LINK_NEXT)){
+                if (block == pos){
+                    if (!IS_ALLOC(pos)){
+                        printf("  cached block is marked free!\n");
+                        return 0;
+                    }
+                    found++;
+                }
+            }
+        }
+        pos = moved_pointer(pos, size, BLOCK_HEADER, BLOCK_END);
+    }
+    if (found != cached){
+        printf("  cached block is not a block of its size in the heap, or cached twice!\n");
+        return 0;
+    }
+    if (verbose)printf("%u blocks in the quick cache\n", cached);
+    return 1;
+}
+#else
+#define quick_debug(verbose) 1
+#endif
+
+#if MM_REALLOC_SLACK
+/*
+ * slack_debug - Checks that every block remembered for its slack is an allocated block of the heap, remembered only once,
+ * at least as large as the size its last realloc needed.
+ */
+static int slack_debug(int verbose){
+    if (HEAP_SIZE() == 0){
+        return 1;
+    }
+    unsigned int tracked = 0, found = 0;
+    for (unsigned int i = 0; i < MM_SLACK_BLOCKS; i++){
+        tracked += ROOT->slack[i].block != NULL;
+    }
+    void *pos = FIRST_BLOCK;
+    while (pos < HEAP_END && GET_SIZE(pos) >= MIN_BLOCK_SIZE){
+        for (unsigned int i = 0; i < MM_SLACK_BLOCKS; i++){
+            if (ROOT->slack[i].block == pos){
+                if (!IS_ALLOC(pos)){
+                    printf("  block with slack is marked free!\n");
+                    return 0;
+                }
+                if (GET_SIZE(pos) < ROOT->slack[i].used){
+                    printf("  block with slack is smaller than its last realloc!\n");
+                    return 0;
+                }
+                found++;
+            }
+        }
+        pos = moved_pointer(pos, GET_SIZE(pos), BLOCK_HEADER, BLOCK_END);
+    }
+    if (found != tracked){
+        printf("  block with slack is not a block of the heap, or remembered twice!\n");
+        return 0;
+    }
+    if (verbose)printf("%u blocks with slack\n", tracked);
+    return 1;
+}
+#else
+#define slack_debug(verbose) 1
+#endif
+
+#if MM_REMOTE_FREE
+/*
+ * remote_debug - Checks that every block on the remote stack of the current arena is in its heap and still allocated
+ * (or in a slab), and that the stack ends.
+ */
+static int remote_debug(int verbose){
+    unsigned long waiting = 0;
+    for (void *ptr = arenas[current_arena].remote; ptr != NULL; ptr = *(void **)ptr){
+        if (ptr < HEAP_LO() || ptr > HEAP_HI()){
+            printf("  block on the remote stack is not in the heap of its arena!\n");
+            return 0;
+        }
+#if MM_SLABS
+        if (slab_of(ptr) == NULL)
+#endif
+        if (!IS_ALLOC(moved_pointer(ptr, 0, BLOCK_PAYLOAD, BLOCK_HEADER))){
+            printf("  block on the remote stack is marked free!\n");
+            return 0;
+        }
+        if (++waiting > HEAP_SIZE() / ALIGNMENT){
+            printf("  the remote stack loops!\n");
+            return 0;
+        }
+    }
+    if (verbose)printf("%lu blocks on the remote stack\n", waiting);
+    return 1;
+}
+#else
+#define remote_debug(verbose) 1
+#endif
+
+/*
+ * mm_check - calls the two functions print_heap_blocks and free_list_debug to perform checks on the heap.
+ * See above docstrings for details. With slabs, slab_debug checks them too, pending_debug the pending blocks of deferred frees
+ * quick_debug the quick cache, slack_debug the blocks that grew with realloc and remote_debug the remote stacks.
+ * Nothing is printed.
+ *
+ * returns 1 if both functions spotted no error, otherwise print error message and returns 0.
+ */
+int mm_check(void){
+#if MM_ARENAS
+    // every arena in turn, nothing else must be running
+    int ok = 1;
+    for (current_arena = 0; current_arena < MM_ARENAS; current_arena++){
+        ok &= print_heap_blocks(0) & free_list_debug(0) & slab_debug(0) & pending_debug(0) & quick_debug(0) & slack_debug(0)
+            & remote_debug(0);
+    }
+    current_arena = 0;
+    return ok;
+#else
+    return print_heap_blocks(0) & free_list_debug(0) & slab_debug(0) & pending_debug(0) & quick_debug(0) & slack_debug(0);
+#endif
+}
+
+/////// arenas
+
+#if MM_ARENAS
+/*
+ * arenas_lock_all, arenas_unlock_all - Hold every arena across a fork, so that the child doesn't inherit a lock taken
+ * by one of the other threads of the parent.
+ */
+static void arenas_lock_all(void){
+    for (int i = 0; i < MM_ARENAS; i++){
+        pthread_mutex_lock(&arenas[i].lock);
+    }
+}
+
+static void arenas_unlock_all(void){
+    for (int i = MM_ARENAS - 1; i >= 0; i--){
+        pthread_mutex_unlock(&arenas[i].lock);
+    }
+}
+
+static void arenas_init(void){
+    for (int i = 0; i < MM_ARENAS; i++){
+        pthread_mutex_init(&arenas[i].lock, NULL);
+    }
+    pthread_atfork(arenas_lock_all, arenas_unlock_all, arenas_unlock_all);
+}
+
+/*
+ * arena_enter - Locks an arena, whose heap is then the one used by the allocator code below until arena_leave().
+ */
+static void arena_enter(int arena){
+    pthread_mutex_lock(&arenas[arena].lock);
+    current_arena = arena;
+}
+
+static void arena_leave(void){
+    pthread_mutex_unlock(&arenas[current_arena].lock);
+}
+
+/*
+ * my_arena - Returns the arena of the calling thread, binding it to the next one (round robin) on its first call.
+ * With MEM_NUMA, only the arenas whose segment is on the node the thread runs on take turns, unless there is none.
+ */
+static int my_arena(void){
+    if (thread_arena < 0){
+        int node = mem_node();
+        int first = -1, local = 0;
+        for (int arena = 0; arena < MM_ARENAS; arena++){
+            if (mem_seg_node(arena) == node){
+                first = (first < 0) ? arena : first;
+                local++;
+            }
+        }
+        if (local == 0){
+            thread_arena = __atomic_fetch_add(&next_arena[0], 1, __ATOMIC_RELAXED) % MM_ARENAS;
+        }else{
+            int turn = __atomic_fetch_add(&next_arena[first], 1, __ATOMIC_RELAXED) % local;
+            for (int arena = first; thread_arena < 0; arena++){
+                if (mem_seg_node(arena) == node && turn-- == 0){
+                    thread_arena = arena;
+                }
+            }
+        }
+    }
+    return thread_arena;
+}
+
+/*
+ * arena_of - Returns the arena owning the block at ptr: the one whose segment contains it.
+ */
+static int arena_of(void *ptr){
+    return mem_seg_of(ptr);
+}
+#else
+// Without arenas there is a single heap and no lock
+#define arena_enter(arena)
+#define arena_leave()
+#define my_arena()          0
+#define arena_of(ptr)       0
+#endif
+
+/////// memory allocator code
+
+#if MM_DEFERRED_FREE
+static void pending_sweep(void);
+#endif
+#if MM_QUICK_CACHE
+static void *quick_malloc(size_t size);
+#endif
+#if MM_QUICK_CACHE || MM_DEFERRED_FREE
+static int heap_flush(void);
+#endif
+#if MM_REALLOC_SLACK
+static int slack_reclaim(void);
+#endif
+#if MM_REMOTE_FREE
+static int remote_drain(void);
+#endif
+
+/*
+ * mm_init - initialize the malloc package. Nothing to do as we don't use any global variable.
+ * Fails if the heap ceiling of memlib is too large for the links or the size classes.
+ * With arenas, splits the (empty) memlib heap in one segment per arena. With slabs, forgets the slabs of the previous heap.
+ */
+int mm_init(void)
+{
+#if MM_COMPACT_LINKS
+    if (mem_max_heap() > 0xFFFFFFFF){
+        return -1;
+    }
+#endif
+#if MM_TLSF
+    if (mem_max_heap() >= (size_t)1 << TLSF_FL_INDEX_MAX){
+        return -1;
+    }
+#endif
+#if MM_ARENAS
+    pthread_once(&arenas_once, arenas_init);
+    mem_set_segments(MM_ARENAS);
+#if MM_REMOTE_FREE
+    // the blocks still waiting belong to the previous heap
+    for (int arena = 0; arena < MM_ARENAS; arena++){
+        arenas[arena].remote = NULL;
+    }
+#endif
+#endif
+#if MM_SLABS
+    // a fresh mapping is all zero, and gives the pages of the old one back
+    if (slab_pages != NULL){
+        munmap(slab_pages, slab_page_count);
+    }
+    slab_page_count = mem_max_heap() / SLAB_SIZE + 1;
+    slab_pages = mmap(NULL, slab_page_count, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (slab_pages == MAP_FAILED){
+        slab_pages = NULL;
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+/*
+ * heap_malloc - Allocate a block in the current heap and returns its adress.
+ * Always allocate a block whose size is a multiple of the alignment.
+ *
+ *  - Fails for sizes above MAX_PAYLOAD, whose block size would wrap around.
+ *  - Asks the index for a fit: chosen by the placement policy with the adress-ordered list or tree (best fit by default),
+ *    the best fit with the size tree, a good fit in constant time with TLSF.
+ *  - With the quick cache, a cached block of the same size is taken first.
+ *  - With remote frees, if no fit is found the blocks freed by the threads of other arenas are freed and the index is asked again.
+ *  - With the quick cache or deferred frees, if no fit is found the cached and pending blocks are freed and the index is asked again.
+ *  - With realloc slack, if there is still no fit, the slack of the blocks that grew is split off and the index is asked again.
+ *  - If a fit is found, if possible split the free block in two: the part we use to allocate the new pointer, and the new free part.
+ *  - If previous search fails and the heap's last block is free, then we extend the heap by the just right amount.
+ *  - Otherwise extends memory by the asked size.
+ *
+ */
+static void *heap_malloc(size_t size)
+{
+    if (size > MAX_PAYLOAD){
+        return NULL;
+    }
+    // To be sure there is enough space to put the links (and footer) when freed
+    if (size < MIN_BLOCK_SIZE - SIZE_T_SIZE){
+        size = MIN_BLOCK_SIZE - SIZE_T_SIZE;
+    }
+
+    size_t newsize = ALIGN(size + SIZE_T_SIZE); // Size is payload size, newsize includes full block
+
+    if (HEAP_SIZE() == 0){ // Basically first call
+        // Make room for the entry points of the free block index
+        if (HEAP_SBRK(ROOT_SIZE) == (void *)-1){
+#if !MM_SILENT
+            printf("Unknown error when allocating first block\n");
+#endif
+            return NULL;
+        }
+        memset(ROOT, 0, sizeof(heap_root_t));
+        STAT_ADD(sbrk_calls, 1);
+    }
+    STAT_ADD(mallocs, 1);
+#if MM_QUICK_CACHE
+    void *cached = quick_malloc(newsize);
+    if (cached != NULL){
+        return cached;
+    }
+#endif
+
+#if MM_STATS
+    unsigned long visited = ROOT->stats.visited;
+#endif
+    void *best_p = index_find(newsize);
+#if MM_REMOTE_FREE
+    // The blocks freed by other arenas may make a fit
+    if (best_p == NULL && remote_drain()){
+        best_p = index_find(newsize);
+    }
+#endif
+#if MM_QUICK_CACHE || MM_DEFERRED_FREE
+    // The cached and pending blocks may make a fit, and are freed before growing the heap
+    if (best_p == NULL && heap_flush()){
+        best_p = index_find(newsize);
+    }
+#endif
+#if MM_REALLOC_SLACK
+    // So is the slack of the blocks that grew
+    if (best_p == NULL && slack_reclaim()){
+        best_p = index_find(newsize);
+    }
+#endif
+#if MM_STATS
+    visited = ROOT->stats.visited - visited;
+    if (visited > ROOT->stats.max_visited){
+        ROOT->stats.max_visited = visited;
+    }
+#endif
+
+    if (best_p == NULL){
+        // we extend only the amount we need
+        void *p = last_free_block();
+        if (p != NULL){
+            // In this case, the last block is free, we can increase by just the right amount!
+            if (HEAP_SBRK(newsize - GET_SIZE(p)) == (void *)-1){
+                return NULL;
+            }
+            STAT_USED(GET_SIZE(p));
+            STAT_ADD(free_blocks, -1);
+            index_remove(p);
+        }else{
+            // The last one wasn't free
+            p = HEAP_SBRK(newsize);
+            if (p == (void *)-1){
+                return NULL;
+            }
+        }
+        STAT_ADD(sbrk_calls, 1);
+        STAT_ADD(live_bytes, newsize);
+        set_header(p, newsize, ALLOC_FLAG);
+        return moved_pointer(p, newsize, BLOCK_HEADER, BLOCK_PAYLOAD);
+    }
+
+    // Else, split if necessary/possible | keep first part free so as not to change the free list (if adress-ordered) but just size
+    size_t best_s = GET_SIZE(best_p);
+    STAT_USED(best_s);
+    if (best_s - newsize >= MIN_BLOCK_SIZE){
+        // If splittable
+        index_resize(best_p, best_s - newsize);
+        best_p = (char *)best_p + best_s - newsize; // Place at the beginning of the newly allocated HEADER
+        set_header(best_p, newsize, ALLOC_FLAG | PREV_FREE);
+        STAT_ADD(splits, 1);
+        STAT_ADD(live_bytes, newsize);
+    }
+    else{
+        // If not splittable, give the whole block
+        index_remove(best_p);
+        set_header(best_p, best_s, ALLOC_FLAG);
+        STAT_ADD(free_blocks, -1);
+        STAT_ADD(live_bytes, best_s);
+    }
+
+    // Finally, return the pointer to the block
+    return moved_pointer(best_p, 0, BLOCK_HEADER, BLOCK_PAYLOAD);
+}
+
+/*
+ * heap_trim - If the last block of the current heap is free, gives back to memlib all of it but pad bytes
+ * (or the whole block if pad is 0). Returns 1 if the heap shrunk, 0 otherwise.
+ */
+static int heap_trim(size_t pad)
+{
+    if (HEAP_SIZE() == 0){
+        return 0;
+    }
+    void *last = last_free_block();
+    if (last == NULL){
+        return 0;
+    }
+    size_t size = GET_SIZE(last);
+    size_t keep = ALIGN(pad);
+    if (keep != 0 && keep < MIN_BLOCK_SIZE){
+        keep = MIN_BLOCK_SIZE;
+    }
+    if (size <= keep){
+        return 0;
+    }
+    STAT_USED(size);
+    STAT_ADD(sbrk_calls, 1);
+
+    if (keep == 0){
+        // the block disappears, the one before it is allocated
+        index_remove(last);
+        STAT_ADD(free_blocks, -1);
+        HEAP_SBRK(-(intptr_t)size);
+#if BOUNDARY_TAGS
+        ROOT->epilogue &= ~(size_t)PREV_FREE_FLAG;
+#endif
+    }else{
+        // shrink first, so that the footer and the epilogue are written at the new end of the heap
+        HEAP_SBRK(-(intptr_t)(size - keep));
+        index_resize(last, keep);
+    }
+    return 1;
+}
+
+#if MM_MADVISE_PAGES
+/*
+ * release_free_pages - Tells the system it can take back the pages inside the free block made of left_size bytes that
+ * were already free, the size bytes just freed and right_size bytes that were already free. The left and right parts
+ * were released when they were formed if they were large enough, so only the rest is. The header, the links and the
+ * footer are kept, so that the block format does not change; the released pages read as zeros once touched again.
+ * When memlib backs the heap with huge pages, only whole huge pages are released, so that none gets split.
+ */
+static void release_free_pages(void *block, size_t left_size, size_t size, size_t right_size)
+{
+    size_t page = mem_heap_pagesize();
+    size_t threshold = MM_MADVISE_PAGES * mem_pagesize();
+    size_t total = left_size + size + right_size;
+    if (threshold < page){
+        threshold = page;
+    }
+    if (total < threshold){
+        return;
+    }
+    char *lo = (char *)block + ((left_size >= threshold) ? left_size : 0);
+    char *hi = (char *)block + total - ((right_size >= threshold) ? right_size : 0);
+    char *first = (char *)block + SIZE_T_SIZE + LINK_WORDS*sizeof(link_t);
+    char *last = (char *)block + total - FOOTER_SIZE;
+
+    if (lo < first){
+        lo = first;
+    }
+    if (hi > last){
+        hi = last;
+    }
+    lo = (char *)(((uintptr_t)lo + page - 1) & ~(uintptr_t)(page - 1));
+    hi = (char *)((uintptr_t)hi & ~(uintptr_t)(page - 1));
+    if (lo < hi){
+#if MM_MADVISE_FREE && defined(MADV_FREE)
+        madvise(lo, hi - lo, MADV_FREE);
+#else
+        madvise(lo, hi - lo, MADV_DONTNEED);
+#endif
+    }
+}
+#endif
+
+/*
+ * heap_free - Frees the given pointer and coalesces free blocks on the right and on the left if possible.
+ * If the resulting block ends the heap and is larger than MM_TRIM_THRESHOLD, the heap is trimmed. Otherwise, if it is larger than
+ * MM_MADVISE_PAGES pages, the pages inside it are released.
+ * The right neighbour is found with the header, the left one with the boundary tags or, in the adress-ordered index,
+ * while looking for the place of the block (linear cost in the list, logarithmic in the tree). Preserves the adress ordering:
+ * with boundary tags and the list, the list is only walked when neither neighbour is free.
+ */
+static void heap_free(void *ptr)
+{
+    void *block = moved_pointer(ptr, 0, BLOCK_PAYLOAD, BLOCK_HEADER);
+    size_t size = GET_SIZE(block);
+    void *next = moved_pointer(block, size, BLOCK_HEADER, BLOCK_END);
+    void *right = (next != HEAP_END && !IS_ALLOC(next)) ? next : NULL;
+    void *left = NULL;
+    void *pred = NULL;
+    STAT_ADD(live_bytes, -size);
+
+#if BOUNDARY_TAGS
+    left = left_free_block(block);
+#else
+    // the left neighbour, if free, is the free block right before in the list
+    pred = index_prev(block);
+    if (pred != NULL && moved_pointer(pred, GET_SIZE(pred), BLOCK_HEADER, BLOCK_END) == block){
+        left = pred;
+    }
+#endif
+#if MM_MADVISE_PAGES
+    size_t left_size = (left != NULL) ? GET_SIZE(left) : 0;
+    size_t right_size = (right != NULL) ? GET_SIZE(right) : 0;
+#endif
+
+    if (left != NULL && right != NULL){
+        // the three blocks become one, which keeps the place of left
+        size_t new_block_size = GET_SIZE(left) + size + GET_SIZE(right);
+        index_remove(right);
+        index_resize(left, new_block_size);
+        STAT_ADD(coalesces, 2);
+        STAT_ADD(free_blocks, -1);
+    }
+    else if (left != NULL){
+        index_resize(left, GET_SIZE(left) + size);
+        STAT_ADD(coalesces, 1);
+    }
+    else if (right != NULL){
+        // block absorbs right and takes its place
+        index_replace(right, block, size + GET_SIZE(right));
+        STAT_ADD(coalesces, 1);
+    }
+    else{
+        STAT_ADD(free_blocks, 1);
+        set_header(block, size, 0);
+#if BOUNDARY_TAGS && ADDR_ORDERED && !MM_ADDR_TREE
+        // no neighbour to take the place of, the list is walked to keep the adress order
+        pred = index_prev(block);
+#endif
+        index_insert(block, pred);
+    }
+
+#if MM_TRIM_THRESHOLD || MM_MADVISE_PAGES
+    void *merged = (left != NULL) ? left : block;
+#endif
+#if MM_TRIM_THRESHOLD
+    // Large free space at the end of the heap goes back to memlib
+    if (GET_SIZE(merged) > MM_TRIM_THRESHOLD && moved_pointer(merged, GET_SIZE(merged), BLOCK_HEADER, BLOCK_END) == HEAP_END
+        && heap_trim(MM_TRIM_PAD)){
+        return;
+    }
+#endif
+#if MM_MADVISE_PAGES
+    // The pages inside a large free block go back to the system
+    release_free_pages(merged, left_size, size, right_size);
+#endif
+}
+
+#if MM_DEFERRED_FREE
+/*
+ * heap_defer - Frees the given pointer later: its block stays allocated in the pending set, which is swept once full.
+ */
+static void heap_defer(void *ptr)
+{
+    ROOT->pending[ROOT->pending_count++] = moved_pointer(ptr, 0, BLOCK_PAYLOAD, BLOCK_HEADER);
+    if (ROOT->pending_count == MM_DEFERRED_FREE){
+        pending_sweep();
+    }
+}
+
+/*
+ * pending_sweep - Frees all the pending blocks in adress order. A run of adjacent pending blocks is first made one
+ * allocated block, so it is inserted in the index and coalesced with its neighbours only once.
+ */
+static void pending_sweep(void)
+{
+    void **pending = ROOT->pending;
+    unsigned int count = ROOT->pending_count;
+
+    // insertion sort, the set is small
+    for (unsigned int i = 1; i < count; i++){
+        void *block = pending[i];
+        unsigned int j = i;
+        while (j > 0 && pending[j-1] > block){
+            pending[j] = pending[j-1];
+            j--;
+        }
+        pending[j] = block;
+    }
+
+    ROOT->pending_count = 0;
+    unsigned int i = 0;
+    while (i < count){
+        void *block = pending[i];
+        size_t size = GET_SIZE(block);
+        for (i++; i < count && pending[i] == moved_pointer(block, size, BLOCK_HEADER, BLOCK_END); i++){
+            size += GET_SIZE(pending[i]);
+        }
+        set_header(block, size, ALLOC_FLAG | (*(size_t *)block & PREV_FREE_FLAG));
+        heap_free(moved_pointer(block, 0, BLOCK_HEADER, BLOCK_PAYLOAD));
+    }
+}
+#endif
+
+#if MM_QUICK_CACHE
+// Blocks leaving the quick cache go through the usual free
+#if MM_DEFERRED_FREE
+#define quick_release(ptr)  heap_defer(ptr)
+#else
+#define quick_release(ptr)  heap_free(ptr)
+#endif
+
+/*
+ * quick_malloc - Takes the last cached block of exactly size bytes (a full block size) and returns its payload, or NULL if there is none.
+ */
+static void *quick_malloc(size_t size)
+{
+    if (size > QUICK_MAX_BLOCK){
+        return NULL;
+    }
+    unsigned int class = QUICK_CLASS(size);
+    void *block = ROOT->quick[class];
+    if (block == NULL){
+        return NULL;
+    }
+    ROOT->quick[class] = get_link(block, LINK_NEXT);
+    ROOT->quick_count[class]--;
+    return moved_pointer(block, 0, BLOCK_HEADER, BLOCK_PAYLOAD);
+}
+
+/*
+ * quick_flush - Frees every block cached in a class.
+ */
+static void quick_flush(unsigned int class)
+{
+    void *block = ROOT->quick[class];
+    ROOT->quick[class] = NULL;
+    ROOT->quick_count[class] = 0;
+    while (block != NULL){
+        void *next = get_link(block, LINK_NEXT);
+        quick_release(moved_pointer(block, 0, BLOCK_HEADER, BLOCK_PAYLOAD));
+        block = next;
+    }
+}
+
+/*
+ * quick_free - Puts a small block in the cache of its size, where it stays allocated. A full class is flushed first,
+ * larger blocks are freed right away.
+ */
+static void quick_free(void *ptr)
+{
+    void *block = moved_pointer(ptr, 0, BLOCK_PAYLOAD, BLOCK_HEADER);
+    size_t size = GET_SIZE(block);
+    if (size > QUICK_MAX_BLOCK){
+        quick_release(ptr);
+        return;
+    }
+    unsigned int class = QUICK_CLASS(size);
+    if (ROOT->quick_count[class] == MM_QUICK_CACHE){
+        quick_flush(class);
+    }
+    set_link(block, LINK_NEXT, ROOT->quick[class]);
+    ROOT->quick[class] = block;
+    ROOT->quick_count[class]++;
+}
+#endif
+
+#if MM_QUICK_CACHE || MM_DEFERRED_FREE
+/*
+ * heap_flush - Frees the blocks of the quick cache and the pending set of the current heap.
+ * Returns 1 if there was any, 0 otherwise.
+ */
+static int heap_flush(void)
+{
+    int flushed = 0;
+    if (HEAP_SIZE() == 0){
+        return 0;
+    }
+#if MM_QUICK_CACHE
+    for (unsigned int class = 0; class < QUICK_CLASSES; class++){
+        if (ROOT->quick[class] != NULL){
+            quick_flush(class);
+            flushed = 1;
+        }
+    }
+#endif
+#if MM_DEFERRED_FREE
+    if (ROOT->pending_count != 0){
+        pending_sweep();
+        flushed = 1;
+    }
+#endif
+    return flushed;
+}
+#endif
+
+/*
+ * heap_realloc - tries to realloc the block pointed by ptr to a size given by asked_size without leaving its place in the current heap.
+ * returns the new pointer if it worked, NULL if the block has to move. *payload_size is set to the payload size of the block before the call.
+ *
+ *  - Does not realloc if asked_size is less or equal then the current block size.
+ *  - Directly extends the block if there is a free block after it. If possible, split it into the allocated part and a new, smaller free block.
+ *  - If ptr points to the last block of the heap, extends the heap by the just right amount and keep the ptr adress.
+ *  - Otherwise if the block before is free, and large enough with the block after if it is free too, the block absorbs
+ *    the space and its payload is moved down with memmove. Its new adress is returned.
+ *
+ */
+static void *heap_realloc(void *ptr, size_t asked_size, size_t *payload_size)
+{
+    void *block = moved_pointer(ptr, 0, BLOCK_PAYLOAD, BLOCK_HEADER);
+    size_t asked_block_size = ALIGN(asked_size+SIZE_T_SIZE); // since the size we store corresponds to the actual size of the full block - not just payload
+    size_t current_size = GET_SIZE(block);
+    size_t prev_flag = *(size_t *)block & PREV_FREE_FLAG;
+
+    *payload_size = current_size - SIZE_T_SIZE;
+
+    // Do we actually have to realloc? With the padding we add, this situation occurs quite often:
+    if(asked_block_size <= current_size){
+        return ptr;
+    }
+
+    // first check if there is already enough space after the block.
+    void* next_block_header = moved_pointer(block,current_size,BLOCK_HEADER,BLOCK_END);
+    //is the next block not the end of the heap and free?
+    if (next_block_header != HEAP_END && !IS_ALLOC(next_block_header)){
+        size_t next_block_size = GET_SIZE(next_block_header);
+        // Is this free block larger than the additionnal space we need?
+        if((asked_block_size-current_size) <= next_block_size){
+            //We just extend block.  Now two cases:
+            //1. What will be left of the free block is enough to constitute a new free block
+            //2. What will remain is too small, in that case we include it in the allocated block to avoid permanent memory leak.
+            size_t new_free_size = next_block_size - (asked_block_size-current_size);
+            STAT_USED(next_block_size);
+
+            if(new_free_size >= MIN_BLOCK_SIZE){
+                //1. What will remain is large enough and will replace the current free block in the index
+                void* new_free_block = moved_pointer(block,asked_block_size,BLOCK_HEADER,BLOCK_END);
+                index_replace(next_block_header, new_free_block, new_free_size);
+                set_header(block, asked_block_size, ALLOC_FLAG | prev_flag);
+                STAT_ADD(splits, 1);
+                STAT_ADD(live_bytes, asked_block_size - current_size);
+            }else
+            {
+                //2. What will remain is too small, in that case we include it in the allocated block to avoid permanent memory leak.
+                index_remove(next_block_header);
+                set_header(block, current_size + next_block_size, ALLOC_FLAG | prev_flag);
+                STAT_ADD(free_blocks, -1);
+                STAT_ADD(live_bytes, next_block_size);
+            }
+            return ptr;
+        }
+    }
+    // Is the block we are trying to realloc the very last?
+    if(next_block_header == HEAP_END){
+        //then we just extend the heap by the amount we need
+        if (HEAP_SBRK(asked_block_size-current_size) != (void *)-1){
+            //update header size
+            set_header(block, asked_block_size, ALLOC_FLAG | prev_flag);
+            STAT_ADD(sbrk_calls, 1);
+            STAT_ADD(live_bytes, asked_block_size - current_size);
+            return ptr;
+        }
+    }
+
+    // Otherwise the block can grow backward into a free block before it (and the one after, if free)
+    void *left;
+#if BOUNDARY_TAGS
+    left = left_free_block(block);
+#else
+    left = index_prev(block);
+    if (left != NULL && moved_pointer(left, GET_SIZE(left), BLOCK_HEADER, BLOCK_END) != block){
+        left = NULL;
+    }
+#endif
+    if (left != NULL){
+        size_t right_size = (next_block_header != HEAP_END && !IS_ALLOC(next_block_header)) ? GET_SIZE(next_block_header) : 0;
+        size_t total_size = GET_SIZE(left) + current_size + right_size;
+        if (total_size >= asked_block_size){
+            if (right_size != 0){
+                STAT_USED(right_size);
+                STAT_ADD(free_blocks, -1);
+                index_remove(next_block_header);
+            }
+            STAT_USED(GET_SIZE(left));
+            // The block goes at the end of the space, so the front of left stays free in its place in the index.
+            // Everything we write before the memmove is below the old block, which still holds the payload.
+            size_t new_free_size = total_size - asked_block_size;
+            void *new_block = left;
+            size_t flags = ALLOC_FLAG;
+            if (new_free_size >= MIN_BLOCK_SIZE){
+                index_resize(left, new_free_size);
+                new_block = (char *)left + new_free_size;
+                flags |= PREV_FREE;
+                STAT_ADD(splits, 1);
+            }else{
+                index_remove(left);
+                asked_block_size = total_size;
+                STAT_ADD(free_blocks, -1);
+            }
+            STAT_ADD(live_bytes, asked_block_size - current_size);
+            void *new_ptr = moved_pointer(new_block, 0, BLOCK_HEADER, BLOCK_PAYLOAD);
+            memmove(new_ptr, ptr, current_size - SIZE_T_SIZE);
+            set_header(new_block, asked_block_size, flags);
+            return new_ptr;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * split_tail - Shrinks an allocated block to size (a multiple of the alignment, at least MIN_BLOCK_SIZE) and frees
+ * the rest, if it is large enough to make a block.
+ */
+static void split_tail(void *block, size_t size)
+{
+    size_t current_size = GET_SIZE(block);
+    if (current_size < size || current_size - size < MIN_BLOCK_SIZE){
+        return;
+    }
+    void *tail = moved_pointer(block, size, BLOCK_HEADER, BLOCK_END);
+    set_header(tail, current_size - size, ALLOC_FLAG);
+    set_header(block, size, ALLOC_FLAG | (*(size_t *)block & PREV_FREE_FLAG));
+    heap_free(moved_pointer(tail, 0, BLOCK_HEADER, BLOCK_PAYLOAD));
+}
+
+#if MM_REALLOC_SLACK
+/*
+ * slack_slot - The entry of the current heap where the block at block is remembered, if it is: the table is direct-mapped.
+ */
+static slack_t *slack_slot(void *block)
+{
+    uint64_t hash = ((uintptr_t)block >> 3) * 0x9E3779B97F4A7C15ull;
+    return &ROOT->slack[(hash >> 32) % MM_SLACK_BLOCKS];
+}
+
+/*
+ * slack_entry - Returns the entry of the current heap remembering the block at block, or NULL.
+ */
+static slack_t *slack_entry(void *block)
+{
+    slack_t *entry = slack_slot(block);
+    return (entry->block == block) ? entry : NULL;
+}
+
+/*
+ * slack_release - Forgets the block of an entry, splitting off the rest of it past the size its last realloc needed.
+ */
+static void slack_release(slack_t *entry)
+{
+    void *block = entry->block;
+    entry->block = NULL;
+    split_tail(block, entry->used);
+}
+
+/*
+ * slack_reclaim - Splits off the slack of every block of the current heap that grew. The blocks stay remembered with
+ * their count of grows, so that they get their room back as soon as they move again.
+ * Returns 1 if any slack was freed, 0 otherwise.
+ */
+static int slack_reclaim(void)
+{
+    int reclaimed = 0;
+    if (HEAP_SIZE() == 0){
+        return 0;
+    }
+    for (unsigned int i = 0; i < MM_SLACK_BLOCKS; i++){
+        void *block = ROOT->slack[i].block;
+        if (block != NULL){
+            size_t size = GET_SIZE(block);
+            split_tail(block, ROOT->slack[i].used);
+            reclaimed |= GET_SIZE(block) < size;
+        }
+    }
+    return reclaimed;
+}
+
+/*
+ * slack_used - The block size a realloc to asked_size needs.
+ */
+static size_t slack_used(size_t asked_size)
+{
+    size_t used = ALIGN(asked_size + SIZE_T_SIZE);
+    return (used < MIN_BLOCK_SIZE) ? MIN_BLOCK_SIZE : used;
+}
+
+/*
+ * slack_track - Remembers that the block needs used bytes and has grown grows times. The block remembered in its entry
+ * before, if another one, is forgotten and its slack split off.
+ */
+static void slack_track(void *block, size_t used, unsigned int grows)
+{
+    slack_t *entry = slack_slot(block);
+    if (entry->block != NULL && entry->block != block){
+        slack_release(entry);
+    }
+    entry->block = block;
+    entry->used = used;
+    entry->grows = grows;
+}
+
+/*
+ * slack_realloc - Called after heap_realloc resized the block at ptr, of payload_size bytes, to asked_size: new_ptr is
+ * where the block is now, or NULL if it has to move.
+ * A block that shrinks below the size its last realloc needed loses its slack, but keeps its count. A block that grows is
+ * remembered at its new place, one more time grown. Returns that count if it has to move, so that it is remembered
+ * again once moved (see slack_moved), 0 otherwise.
+ */
+static unsigned int slack_realloc(void *ptr, void *new_ptr, size_t asked_size, size_t payload_size)
+{
+    void *block = moved_pointer(ptr, 0, BLOCK_PAYLOAD, BLOCK_HEADER);
+    size_t used = slack_used(asked_size);
+    unsigned int grows = 0;
+    slack_t *entry = slack_entry(block);
+    if (entry != NULL){
+        if (used <= entry->used){
+            if (used < entry->used){
+                entry->used = used;
+                split_tail(block, used);
+            }
+            return 0;
+        }
+        grows = entry->grows;
+        entry->block = NULL;
+    }else if (used <= payload_size + SIZE_T_SIZE){
+        return 0;
+    }
+    grows++;
+    if (new_ptr != NULL){
+        slack_track(moved_pointer(new_ptr, 0, BLOCK_PAYLOAD, BLOCK_HEADER), used, grows);
+        return 0;
+    }
+    return grows;
+}
+
+/*
+ * slack_forget - The block at ptr is freed: it is forgotten, its slack goes back with it.
+ */
+static void slack_forget(void *ptr)
+{
+    slack_t *entry = slack_entry(moved_pointer(ptr, 0, BLOCK_PAYLOAD, BLOCK_HEADER));
+    if (entry != NULL){
+        entry->block = NULL;
+    }
+}
+#endif
 
-    size_t asked_block_size = ALIGN(asked_size+SIZE_T_SIZE); // since the size we store corresponds to the actual size of the full block - not just payload
-    size_t current_size = *(size_t*) moved_pointer(ptr,0,BLOCK_PAYLOAD,BLOCK_HEADER)-1; //-1 because of flag
-
-    // Do we actually have to realloc? With the padding we add, this situation occurs quite often:
-    if(asked_block_size <= current_size){
-        return ptr;
+/*
+ * heap_memalign - Allocate a block whose payload adress is a multiple of align (a power of two) in the current heap.
+ * We allocate enough to find an aligned payload leaving room for a block before it, then free what is before and after.
+ * The pieces go back to the index, and when the heap grows the next aligned block usually starts right after this one.
+ */
+static void *heap_memalign(size_t align, size_t size)
+{
+    // The front piece and the rounding must not wrap around either, see heap_malloc
+    if (align > MAX_PAYLOAD - MIN_BLOCK_SIZE || size > MAX_PAYLOAD - MIN_BLOCK_SIZE - align){
+        return NULL;
     }
-    
-    // first check if there is already enough space after the block.
-    void* next_block_header = moved_pointer(ptr,current_size,BLOCK_PAYLOAD,BLOCK_END);
-    size_t next_block_size = *(size_t*) next_block_header;
-    //is the next block not the end of the heap and free?
-    if ((current_size < asked_block_size) && (next_block_header != (void*)((char*) mem_heap_hi()+1)) && !(next_block_size&1)){
-        // Is this free block larger than the additionnal space we need?
-        if((asked_block_size-current_size) <= (next_block_size)){
-            //We just extend block.  Now two cases:
-            //1. What will be left of the free block is enough to constitute a new free block
-            //2. What will remain is too small, in that case we include it in the allocated block to avoid permanent memory leak.
+    // So that the aligned block left after the front piece is large enough to be one
+    if (size < MIN_BLOCK_SIZE - SIZE_T_SIZE){
+        size = MIN_BLOCK_SIZE - SIZE_T_SIZE;
+    }
+    size = ALIGN(size);
+    char *ptr = heap_malloc(size + align + MIN_BLOCK_SIZE);
+    if (ptr == NULL){
+        return NULL;
+    }
+    void *block = moved_pointer(ptr, 0, BLOCK_PAYLOAD, BLOCK_HEADER);
+    char *aligned = (char *)(((uintptr_t)ptr + align - 1) & ~(uintptr_t)(align - 1));
 
-            if((int)(next_block_size - (asked_block_size-current_size)) >= SIZE_T_SIZE + 2*sizeof(void *)){
-                //1. What will remain is large enough and will replace the current free block in the linkedlist
-                //save free block info
-                void* next_forward = *(void**)moved_pointer(next_block_header,next_block_size,BLOCK_HEADER,BLOCK_FORWARD);
-                void* next_backward = *(void**)moved_pointer(next_block_header,next_block_size,BLOCK_HEADER,BLOCK_BACKWARD);
-                
-                // We extend the memory block
-                *(size_t*) moved_pointer(ptr,0,BLOCK_PAYLOAD,BLOCK_HEADER) = asked_block_size+1; //+1 for flag
-                
-                // We create the new free block
-                void* new_free_block_head = moved_pointer(ptr,asked_block_size,BLOCK_PAYLOAD,BLOCK_END);
-                void* new_free_block = moved_pointer(new_free_block_head,0,BLOCK_HEADER,BLOCK_FORWARD);
-                void* new_free_block_backward = moved_pointer(new_free_block_head,0,BLOCK_HEADER,BLOCK_BACKWARD);
-                size_t new_free_size = (size_t)(next_block_size - (asked_block_size-current_size));
-                
-                *(size_t*) new_free_block_head = new_free_size;
-                *(void**)moved_pointer(new_free_block_head,new_free_size,BLOCK_HEADER,BLOCK_FORWARD) = next_forward;
-                *(void**)moved_pointer(new_free_block_head,new_free_size,BLOCK_HEADER,BLOCK_BACKWARD) = next_backward;
-
-
-                // update the linked list 
-
-                // change backward of next element, if it is not NULL
-                if(next_forward != NULL){
-                    
-                    size_t next_forward_size = *(size_t*) moved_pointer(next_forward,0,BLOCK_FORWARD,BLOCK_HEADER);
-                    *(void**)moved_pointer(next_forward,next_forward_size,BLOCK_FORWARD,BLOCK_BACKWARD) = new_free_block_backward;
-                }
+    if (aligned != ptr){
+        // The part before has to make a block on its own
+        while (aligned - ptr < MIN_BLOCK_SIZE){
+            aligned += align;
+        }
+        size_t front_size = aligned - ptr;
+        void *aligned_block = moved_pointer(aligned, 0, BLOCK_PAYLOAD, BLOCK_HEADER);
+        set_header(aligned_block, GET_SIZE(block) - front_size, ALLOC_FLAG);
+        set_header(block, front_size, ALLOC_FLAG | (*(size_t *)block & PREV_FREE_FLAG));
+        heap_free(ptr);
+        block = aligned_block;
+    }
+    size = ALIGN(size + SIZE_T_SIZE);
+    split_tail(block, (size < MIN_BLOCK_SIZE) ? MIN_BLOCK_SIZE : size);
+    return aligned;
+}
 
-                //change forward of previous element if not NULL
-                if(next_backward != NULL){
-                    *(void**) moved_pointer(next_backward,0,BLOCK_BACKWARD,BLOCK_FORWARD) = new_free_block;
-                }else{
-                    //it was actually the first free block of the linked list, so we have to change the entry pointer
-                    *(void**)mem_heap_lo() =  new_free_block;   
-                }
-                
-            }else
-            {
-                //2. What will remain is too small, in that case we include it in the allocated block to avoid permanent memory leak.
-                //save free block info
-                void* next_forward = *(void**)moved_pointer(next_block_header,next_block_size,BLOCK_HEADER,BLOCK_FORWARD);
-                void* next_backward = *(void**)moved_pointer(next_block_header,next_block_size,BLOCK_HEADER,BLOCK_BACKWARD);
-                
-                // We extend the memory block
-                *(size_t*) moved_pointer(ptr,0,BLOCK_PAYLOAD,BLOCK_HEADER) = current_size+next_block_size+1; //+1 for flag
-                
-
-                // There is no more free block, we have to remove it from the LinkedList 
-                // change backward of next element, if it is not NULL
-                if(next_forward != NULL){
-                    *(void**)moved_pointer(next_forward,0,BLOCK_FORWARD,BLOCK_BACKWARD) = next_backward;
-                }
-                
-                //change forward of previous element if not NULL
-                if(next_backward != NULL){
-                    *(void**) moved_pointer(next_backward,0,BLOCK_BACKWARD,BLOCK_FORWARD) = next_forward;
-                }else{
-                    
-                    //it was actually the first free block of the linked list, so we have to change the entry pointer
-                    *(void**)mem_heap_lo() =  NULL;
+/////// slabs
+
+#if MM_SLABS
+/*
+ * slab_of - Returns the slab holding ptr, or NULL if ptr is not in a slab. Works for any heap, as the page map covers
+ * all the memlib segments.
+ */
+static slab_t *slab_of(void *ptr){
+    size_t page = (uintptr_t)ptr / SLAB_SIZE - (uintptr_t)mem_heap_lo() / SLAB_SIZE;
+    if (page >= slab_page_count || !slab_pages[page]){
+        return NULL;
+    }
+    return (slab_t *)((uintptr_t)ptr & ~(uintptr_t)(SLAB_SIZE - 1));
+}
+
+static void slab_set_page(slab_t *slab, unsigned char is_slab){
+    slab_pages[(uintptr_t)slab / SLAB_SIZE - (uintptr_t)mem_heap_lo() / SLAB_SIZE] = is_slab;
+}
+
+static void slab_push(slab_t *slab){
+    slab->prev = NULL;
+    slab->next = ROOT->slabs[slab->class];
+    if (slab->next != NULL){
+        slab->next->prev = slab;
+    }
+    ROOT->slabs[slab->class] = slab;
+}
+
+static void slab_unlink(slab_t *slab){
+    if (slab->prev != NULL){
+        slab->prev->next = slab->next;
+    }else{
+        ROOT->slabs[slab->class] = slab->next;
+    }
+    if (slab->next != NULL){
+        slab->next->prev = slab->prev;
+    }
+}
+
+/*
+ * slab_create - Takes a new slab for a class from the current heap, links all its objects as free and puts it
+ * in the list of its class.
+ */
+static slab_t *slab_create(unsigned int class){
+    slab_t *slab = heap_memalign(SLAB_SIZE, SLAB_PAYLOAD);
+    if (slab == NULL){
+        return NULL;
+    }
+    size_t object_size = slab_class_size[class];
+    char *object = (char *)slab + SLAB_HEADER_SIZE;
+    char *end = (char *)slab + SLAB_PAYLOAD;
+
+    slab->class = class;
+    slab->used = 0;
+    slab->free = object;
+    while (object + 2*object_size <= end){
+        *(void **)object = object + object_size;
+        object += object_size;
+    }
+    *(void **)object = NULL;
+
+    slab_set_page(slab, 1);
+    slab_push(slab);
+    return slab;
+}
+
+/*
+ * slab_malloc - Allocate an object of the class of size (at most SLAB_MAX_OBJECT) from the first slab of the class
+ * having a free one, creating a slab if there is none (with remote frees, after draining the remote stack).
+ * A slab which becomes full leaves the list of its class.
+ */
+static void *slab_malloc(size_t size){
+    unsigned int class = slab_class_of[(size + ALIGNMENT - 1) / ALIGNMENT];
+    slab_t *slab = (HEAP_SIZE() == 0) ? NULL : ROOT->slabs[class];
+
+#if MM_REMOTE_FREE
+    // objects freed by other arenas may give a slab back to the class
+    if (slab == NULL && remote_drain()){
+        slab = ROOT->slabs[class];
+    }
+#endif
+    if (slab == NULL){
+        slab = slab_create(class);
+        if (slab == NULL){
+            return NULL;
+        }
+    }
+    void *object = slab->free;
+    slab->free = *(void **)object;
+    slab->used++;
+    if (slab->free == NULL){
+        slab_unlink(slab);
+    }
+    return object;
+}
+
+/*
+ * slab_free - Gives an object back to its slab. A full slab goes back to the list of its class. An empty slab is given
+ * back to the heap, unless it is the only one of its class, so that a class used by a single object does not take
+ * and give back a slab at every malloc and free.
+ */
+static void slab_free(slab_t *slab, void *ptr){
+    if (slab->free == NULL){
+        slab_push(slab);
+    }
+    *(void **)ptr = slab->free;
+    slab->free = ptr;
+    slab->used--;
+
+    if (slab->used == 0 && (slab->prev != NULL || slab->next != NULL)){
+        slab_unlink(slab);
+        slab_set_page(slab, 0);
+        heap_free(slab);
+    }
+}
+
+/*
+ * slab_realloc - Objects can't grow: returns ptr if asked_size still fits in its class, NULL otherwise.
+ * *payload_size is set to the size of the class.
+ */
+static void *slab_realloc(slab_t *slab, void *ptr, size_t asked_size, size_t *payload_size){
+    *payload_size = slab_class_size[slab->class];
+    return (asked_size <= *payload_size) ? ptr : NULL;
+}
+
+/*
+ * slab_debug - Checks the slabs having free objects of the current heap: they are in the page map and in the list of
+ * their class, and their free objects are inside them, on an object boundary, and as many as they should.
+ *
+ * if verbose = 1, it will print. If verbose = 0, it will only check.
+ * returns 1 if everything went well, otherwise print error message and returns 0.
+ */
+static int slab_debug(int verbose){
+    if (HEAP_SIZE() == 0){
+        return 1;
+    }
+    for (unsigned int class = 0; class < SLAB_CLASSES; class++){
+        size_t object_size = slab_class_size[class];
+        size_t count = (SLAB_PAYLOAD - SLAB_HEADER_SIZE) / object_size;
+        slab_t *prev = NULL;
+
+        for (slab_t *slab = ROOT->slabs[class]; slab != NULL; slab = slab->next){
+            if(verbose)printf("slab %p: class %zu, %u used\n", (void *)slab, object_size, slab->used);
+            if (slab_of(slab) != slab || slab->class != class || slab->prev != prev){
+                printf("   slab %p is not in the page map or in the wrong list\n", (void *)slab);
+                return 0;
+            }
+            size_t free_count = 0;
+            for (char *object = slab->free; object != NULL; object = *(void **)object){
+                size_t offset = object - ((char *)slab + SLAB_HEADER_SIZE);
+                if (object < (char *)slab + SLAB_HEADER_SIZE || offset % object_size != 0 || offset / object_size >= count
+                    || ++free_count > count){
+                    printf("   free object %p of slab %p is WRONG\n", (void *)object, (void *)slab);
+                    return 0;
                 }
-                
             }
-            return ptr;
+            if (free_count == 0 || free_count + slab->used != count){
+                printf("   slab %p has %zu free objects and %u used, out of %zu\n", (void *)slab, free_count, slab->used, count);
+                return 0;
+            }
+            prev = slab;
         }
     }
-    // Is the block we are trying to realloc the very last?
-    if(next_block_header == (void*)((char*) mem_heap_hi()+1)){
-        //then we just extend the heap by the amount we need
-        mem_sbrk(asked_block_size-current_size);
-        //update header size
-        *(size_t*)moved_pointer(ptr,0,BLOCK_PAYLOAD,BLOCK_HEADER) = asked_block_size+1;//+1 for flag
+    return 1;
+}
+#endif
+
+/////// huge blocks
+
+#if MM_MMAP_THRESHOLD
+#define PAGE_ROUNDUP(size)  (((size) + mem_pagesize() - 1) & ~(mem_pagesize() - 1))
+#define PAGE_OF(p)          ((char *)((uintptr_t)(p) & ~(uintptr_t)(mem_pagesize() - 1)))
+
+/*
+ * A huge block has a mapping of its own, and its header holds the size of the whole mapping. The header is in the
+ * first page of the mapping, usually at its very beginning (see huge_move for the exception), so the mapping
+ * starts at the page of the header.
+ */
+
+/*
+ * is_huge - Returns 1 if ptr is a block with a mapping of its own. Slab objects have no header, so they are ruled out first.
+ */
+static int is_huge(void *ptr){
+#if MM_SLABS
+    if (slab_of(ptr) != NULL){
+        return 0;
+    }
+#endif
+    return IS_MMAPPED(moved_pointer(ptr, 0, BLOCK_PAYLOAD, BLOCK_HEADER)) != 0;
+}
+
+/*
+ * huge_map - Maps a huge block whose header is offset bytes after the beginning of the mapping, for a payload of size bytes.
+ * No lock is needed, memlib keeps track of the mappings.
+ */
+static void *huge_map(size_t offset, size_t size){
+    // a size near SIZE_MAX would wrap around when rounded up to pages
+    if (size > SIZE_MAX - offset - SIZE_T_SIZE - mem_pagesize()){
+        return NULL;
+    }
+    size_t map_size = PAGE_ROUNDUP(offset + size + SIZE_T_SIZE);
+    char *start = mem_map(map_size);
+    if (start == NULL){
+        return NULL;
+    }
+    *(size_t *)(start + offset) = map_size | MMAPPED_FLAG | ALLOC_FLAG;
+    return moved_pointer(start + offset, 0, BLOCK_HEADER, BLOCK_PAYLOAD);
+}
+
+static void *huge_malloc(size_t size){
+    return huge_map(0, size);
+}
+
+static void huge_free(void *ptr){
+    mem_unmap(PAGE_OF(moved_pointer(ptr, 0, BLOCK_PAYLOAD, BLOCK_HEADER)));
+}
+
+/*
+ * huge_realloc - Resizes the mapping of a huge block with mremap: the pages are moved, not copied.
+ * returns the new pointer, or NULL if the block should go back to the heap (it became smaller than half the threshold,
+ * so that a block around the threshold doesn't go back and forth) or if the mapping can't grow (or the size would wrap
+ * around).
+ * *payload_size is set to the payload size of the block before the call.
+ */
+static void *huge_realloc(void *ptr, size_t asked_size, size_t *payload_size){
+    char *block = moved_pointer(ptr, 0, BLOCK_PAYLOAD, BLOCK_HEADER);
+    char *start = PAGE_OF(block);
+    size_t offset = block - start;
+
+    *payload_size = GET_SIZE(block) - offset - SIZE_T_SIZE;
+    if (asked_size < MM_MMAP_THRESHOLD / 2 || asked_size > SIZE_MAX - offset - SIZE_T_SIZE - mem_pagesize()){
+        return NULL;
+    }
+    size_t map_size = PAGE_ROUNDUP(offset + asked_size + SIZE_T_SIZE);
+    if (map_size == GET_SIZE(block)){
+        return ptr;
+    }
+    start = mem_remap(start, map_size);
+    if (start == NULL){
+        return NULL;
+    }
+    *(size_t *)(start + offset) = map_size | MMAPPED_FLAG | ALLOC_FLAG;
+    return moved_pointer(start + offset, 0, BLOCK_HEADER, BLOCK_PAYLOAD);
+}
+
+/*
+ * huge_move - Moves the payload_size bytes at ptr, in the heap, to a new huge block of asked_size bytes, without copying
+ * the whole pages: the new payload is placed at the same offset in its page as the old one, so that the pages inside the
+ * old payload can be moved by memlib with mremap. Only the bytes before the first of these pages and after the last
+ * one are copied. The old block is left allocated, and returns NULL if there is no memory.
+ */
+static void *huge_move(void *ptr, size_t payload_size, size_t asked_size){
+    size_t page = mem_pagesize();
+    char *block = moved_pointer(ptr, 0, BLOCK_PAYLOAD, BLOCK_HEADER);
+    char *newptr = huge_map(block - PAGE_OF(block), asked_size);
+    if (newptr == NULL){
+        return NULL;
+    }
+    char *lo = PAGE_OF((char *)ptr + page - 1);
+    char *hi = PAGE_OF((char *)ptr + payload_size);
+
+    if (lo < hi && mem_move_pages(newptr + (lo - (char *)ptr), lo, hi - lo) == 0){
+        memcpy(newptr, ptr, lo - (char *)ptr);
+        memcpy(newptr + (hi - (char *)ptr), hi, (char *)ptr + payload_size - hi);
+    }else{
+        memcpy(newptr, ptr, payload_size);
+    }
+    return newptr;
+}
+#endif
+
+#if MM_REALLOC_SLACK
+/*
+ * slack_moved - A block that grew grows times was moved to ptr by realloc, to hold asked_size bytes: it is remembered
+ * in the arena that owns it now, unless it went to a slab or a mapping.
+ */
+static void slack_moved(void *ptr, size_t asked_size, unsigned int grows)
+{
+#if MM_MMAP_THRESHOLD
+    if (is_huge(ptr)){
+        return;
+    }
+#endif
+    arena_enter(arena_of(ptr));
+#if MM_SLABS
+    if (slab_of(ptr) == NULL)
+#endif
+    {
+        slack_track(moved_pointer(ptr, 0, BLOCK_PAYLOAD, BLOCK_HEADER), slack_used(asked_size), grows);
+    }
+    arena_leave();
+}
+#endif
+
+/*
+ * arena_malloc - Allocate a block in the arena, see heap_malloc, or an object in one of its slabs.
+ */
+static void *arena_malloc(int arena, size_t size)
+{
+    arena_enter(arena);
+#if MM_SLABS
+    void *ptr = (size <= SLAB_MAX_OBJECT) ? slab_malloc(size) : heap_malloc(size);
+#else
+    void *ptr = heap_malloc(size);
+#endif
+    arena_leave();
+    return ptr;
+}
+
+/*
+ * mm_malloc - Allocate a block in the arena of the calling thread, see arena_malloc. If its segment is full, the other
+ * arenas are tried in turn. Huge requests get a mapping of their own.
+ */
+void *mm_malloc(size_t size)
+{
+#if MM_MMAP_THRESHOLD
+    if (size >= MM_MMAP_THRESHOLD){
+        return huge_malloc(size);
+    }
+#endif
+    void *ptr = arena_malloc(my_arena(), size);
+#if MM_ARENAS
+    for (int i = 1; ptr == NULL && i < MM_ARENAS; i++){
+        ptr = arena_malloc((thread_arena + i) % MM_ARENAS, size);
+    }
+#endif
+    return ptr;
+}
+
+/*
+ * mm_memalign - Allocate a block whose payload adress is a multiple of align (a power of two) in the arena of the
+ * calling thread, or in the others in turn if its segment is full, see heap_memalign. Always in the heap, as huge
+ * blocks have their header at the start of their pages.
+ */
+void *mm_memalign(size_t align, size_t size)
+{
+    if (align <= ALIGNMENT){
+        return mm_malloc(size);
+    }
+    arena_enter(my_arena());
+    void *ptr = heap_memalign(align, size);
+    arena_leave();
+#if MM_ARENAS
+    for (int i = 1; ptr == NULL && i < MM_ARENAS; i++){
+        arena_enter((thread_arena + i) % MM_ARENAS);
+        ptr = heap_memalign(align, size);
+        arena_leave();
+    }
+#endif
+    return ptr;
+}
+
+/*
+ * heap_release - Frees the block or the slab object at ptr in the current heap, see heap_free (or quick_free and heap_defer)
+ * and slab_free.
+ */
+static void heap_release(void *ptr)
+{
+#if MM_SLABS
+    slab_t *slab = slab_of(ptr);
+    if (slab != NULL){
+        slab_free(slab, ptr);
+        return;
+    }
+#endif
+#if MM_REALLOC_SLACK
+    slack_forget(ptr);
+#endif
+#if MM_QUICK_CACHE
+    quick_free(ptr);
+#elif MM_DEFERRED_FREE
+    heap_defer(ptr);
+#else
+    heap_free(ptr);
+#endif
+}
+
+#if MM_REMOTE_FREE
+/*
+ * remote_push - Pushes a block of an arena the calling thread is not bound to on the remote stack of that arena, with
+ * a single compare and swap and without its lock. The block is only freed when the arena drains its stack.
+ */
+static void remote_push(int arena, void *ptr)
+{
+    void *top = __atomic_load_n(&arenas[arena].remote, __ATOMIC_RELAXED);
+    do {
+        *(void **)ptr = top;
+    } while (!__atomic_compare_exchange_n(&arenas[arena].remote, &top, ptr, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * remote_drain - Takes the whole remote stack of the current arena at once and frees its blocks.
+ * returns 1 if there was any, 0 otherwise.
+ */
+static int remote_drain(void)
+{
+    void *ptr = __atomic_exchange_n(&arenas[current_arena].remote, NULL, __ATOMIC_ACQUIRE);
+    if (ptr == NULL){
+        return 0;
+    }
+    while (ptr != NULL){
+        void *next = *(void **)ptr;
+        heap_release(ptr);
+        ptr = next;
+    }
+    return 1;
+}
+#endif
+
+/*
+ * mm_free - Frees the given pointer in the arena that owns it, see heap_release. Huge blocks are unmapped.
+ * With remote frees, a block of an arena the calling thread is not bound to is pushed on its remote stack instead, see remote_push.
+ */
+void mm_free(void *ptr)
+{
+#if MM_MMAP_THRESHOLD
+    if (is_huge(ptr)){
+        huge_free(ptr);
+        return;
+    }
+#endif
+#if MM_REMOTE_FREE
+    int arena = arena_of(ptr);
+    if (arena != thread_arena){
+        remote_push(arena, ptr);
+        return;
+    }
+#endif
+    arena_enter(arena_of(ptr));
+    heap_release(ptr);
+    arena_leave();
+}
+
+/*
+ * mm_realloc - reallocs a block pointed by ptr to a size given by asked_size. returns a pointer to the adress of the new block.
+ * Calling with ptr==NULL is equivalent to a call to malloc. Calling with asked_size=0 and ptr!=NULL is equivalent to free.
+ *
+ *  - Fails, leaving the block as it is, for sizes above MAX_PAYLOAD.
+ *  - Tries to realloc in place in the arena owning the block, see heap_realloc (a slab object only stays if it still fits its class).
+ *  - A huge block is resized with mremap instead, see huge_realloc. A block becoming huge gets its pages moved, see huge_move.
+ *  - IF it fails, we default to a call to malloc and free. With realloc slack, a block that grew often enough gets half
+ *    as much room again, see slack_realloc.
+ *
+ */
+void *mm_realloc(void *ptr, size_t asked_size)
+{
+
+    // dealing with degenerate cases
+    if(ptr==NULL){
+
+        return mm_malloc(asked_size);
+    }
+    if(asked_size==0){
+
+        mm_free(ptr);
         return ptr;
     }
+    // A size near SIZE_MAX would wrap around when rounded to a block, see heap_malloc
+    if (asked_size > MAX_PAYLOAD){
+        return NULL;
+    }
+
+    size_t copySize; // the whole old payload
+    void *newptr;
+#if MM_REALLOC_SLACK
+    unsigned int grows = 0;
+#endif
+#if MM_MMAP_THRESHOLD
+    if (is_huge(ptr)){
+        newptr = huge_realloc(ptr, asked_size, &copySize);
+    }else
+#endif
+    {
+        arena_enter(arena_of(ptr));
+#if MM_SLABS
+        slab_t *slab = slab_of(ptr);
+        if (slab != NULL){
+            newptr = slab_realloc(slab, ptr, asked_size, &copySize);
+        }else
+#endif
+        {
+            newptr = heap_realloc(ptr, asked_size, &copySize);
+#if MM_REALLOC_SLACK
+            grows = slack_realloc(ptr, newptr, asked_size, copySize);
+#endif
+        }
+        STAT_ADD(reallocs_in_place, newptr != NULL);
+        STAT_ADD(realloc_copies, newptr == NULL);
+        arena_leave();
+    }
+    if (newptr != NULL){
+        return newptr;
+    }
+
+#if MM_MMAP_THRESHOLD
+    // A heap block becoming huge moves to a mapping, by moving its pages when it is large enough
+    if (asked_size >= MM_MMAP_THRESHOLD && !is_huge(ptr) && copySize < asked_size){
+        newptr = huge_move(ptr, copySize, asked_size);
+        if (newptr != NULL){
+            mm_free(ptr);
+            return newptr;
+        }
+    }
+#endif
+
     //defaulting to the good old way: malloc + free.
     void *oldptr = ptr;
-    void *newptr;
-    size_t copySize;
 
+#if MM_REALLOC_SLACK
+    // A block that keeps growing moves with half as much room again, to grow in place the next times
+    if (grows >= MM_REALLOC_SLACK && (MM_MMAP_THRESHOLD == 0 || asked_size + asked_size / 2 < MM_MMAP_THRESHOLD)){
+        newptr = mm_malloc(asked_size + asked_size / 2);
+    }
+    if (newptr == NULL)
+#endif
     newptr = mm_malloc(asked_size);
 
     if (newptr == NULL){
+#if !MM_SILENT
         printf("_______________Error reallocating memory_______________\n");
+#endif
         return NULL;
     }
 
-    copySize = *(size_t *)((char *)oldptr);
-
     if (asked_size < copySize)
         copySize = asked_size;
-    
-    memcpy(newptr, oldptr, asked_size);
+
+    memcpy(newptr, oldptr, copySize);
+#if MM_REALLOC_SLACK
+    if (grows != 0){
+        slack_moved(newptr, asked_size, grows);
+    }
+#endif
     mm_free(oldptr);
-    
+
     return newptr;
 }
 // :)
+
+/*
+ * mm_usable_size - Returns how many bytes the payload at ptr can hold: the size of its slab class, or the size of its
+ * block (or mapping) but the header. Only the block itself is read, so no lock is taken, but with realloc slack: the
+ * slack of a block that grew may be split off at any time, so only the size its last realloc needed is given.
+ */
+size_t mm_usable_size(void *ptr)
+{
+    char *block = moved_pointer(ptr, 0, BLOCK_PAYLOAD, BLOCK_HEADER);
+#if MM_MMAP_THRESHOLD
+    if (is_huge(ptr)){
+        return GET_SIZE(block) - (block - PAGE_OF(block)) - SIZE_T_SIZE;
+    }
+#endif
+#if MM_SLABS
+    slab_t *slab = slab_of(ptr);
+    if (slab != NULL){
+        return slab_class_size[slab->class];
+    }
+#endif
+#if MM_REALLOC_SLACK
+    arena_enter(arena_of(ptr));
+    slack_t *entry = slack_entry(block);
+    size_t used = (entry != NULL) ? entry->used : GET_SIZE(block);
+    arena_leave();
+    return used - SIZE_T_SIZE;
+#else
+    return GET_SIZE(block) - SIZE_T_SIZE;
+#endif
+}
+
+/*
+ * mm_trim - Gives back to memlib the free space at the end of the heap (of every arena), but pad bytes.
+ * The blocks waiting on the remote stacks, the blocks of the quick cache and the pending blocks of deferred frees are
+ * freed first, and the slack of the blocks that grew with realloc is split off.
+ * returns 1 if some memory was released, 0 otherwise.
+ */
+int mm_trim(size_t pad)
+{
+    int released = 0;
+#if MM_ARENAS
+    for (int arena = 0; arena < MM_ARENAS; arena++){
+        arena_enter(arena);
+#if MM_REMOTE_FREE
+        remote_drain();
+#endif
+#if MM_QUICK_CACHE || MM_DEFERRED_FREE
+        heap_flush();
+#endif
+#if MM_REALLOC_SLACK
+        slack_reclaim();
+#endif
+        released |= heap_trim(pad);
+        arena_leave();
+    }
+#else
+#if MM_QUICK_CACHE || MM_DEFERRED_FREE
+    heap_flush();
+#endif
+#if MM_REALLOC_SLACK
+    slack_reclaim();
+#endif
+    released = heap_trim(pad);
+#endif
+    return released;
+}
+
+/////// statistics
+
+#if MM_STATS
+#if MM_MAX_NODES < MEM_MAX_NODES
+#error "mm_stats can't report every NUMA node of memlib"
+#endif
+
+/*
+ * heap_stats - Adds the counters of the current heap to *stats (and to those of its NUMA node), and its number of visited
+ * free blocks to *visited. The largest free block is looked for in the index only if it is stale.
+ */
+static void heap_stats(struct mm_stats *stats, unsigned long *visited)
+{
+    if (HEAP_SIZE() == 0){
+        return;
+    }
+    heap_stats_t *h = &ROOT->stats;
+    int node = mem_seg_node(mem_seg_of(HEAP_LO()));
+    if (h->largest_stale){
+        h->largest_free = index_largest();
+        h->largest_stale = 0;
+    }
+    stats->heap_bytes += HEAP_SIZE();
+    stats->live_bytes += h->live_bytes;
+    stats->free_bytes += HEAP_SIZE() - ROOT_SIZE - h->live_bytes;
+    stats->free_blocks += h->free_blocks;
+    if (h->largest_free > stats->largest_free_block){
+        stats->largest_free_block = h->largest_free;
+    }
+    if (h->max_visited > stats->max_visited){
+        stats->max_visited = h->max_visited;
+    }
+    stats->mallocs += h->mallocs;
+    stats->splits += h->splits;
+    stats->coalesces += h->coalesces;
+    stats->reallocs_in_place += h->reallocs_in_place;
+    stats->realloc_copies += h->realloc_copies;
+    stats->sbrk_calls += h->sbrk_calls;
+    stats->node_heap_bytes[node] += HEAP_SIZE();
+    stats->node_live_bytes[node] += h->live_bytes;
+    *visited += h->visited;
+}
+#endif
+
+/*
+ * mm_stats - Fills *stats with the counters of the heaps (of every arena, and of the arenas of each NUMA node for the
+ * heap and live bytes) and the bytes mapped for huge blocks.
+ * returns 0, or -1 without MM_STATS. Nothing is walked but, when the largest free block was used since the last call,
+ * the free block index (the list or the adress tree, the highest class of TLSF, the right spine of the size tree).
+ */
+int mm_stats(struct mm_stats *stats)
+{
+#if MM_STATS
+    unsigned long visited = 0;
+
+    memset(stats, 0, sizeof(*stats));
+#if MM_ARENAS
+    for (int arena = 0; arena < MM_ARENAS; arena++){
+        arena_enter(arena);
+        heap_stats(stats, &visited);
+        arena_leave();
+    }
+#else
+    heap_stats(stats, &visited);
+#endif
+    stats->mapped_bytes = mem_mapped_bytes();
+    stats->nodes = mem_nodes();
+    stats->avg_visited = (stats->mallocs != 0) ? (double)visited / stats->mallocs : 0;
+    return 0;
+#else
+    (void)stats;
+    return -1;
+#endif
+}
@@ -2,8 +2,47 @@
 
 extern int mm_init (void);
 extern void *mm_malloc (size_t size);
+extern void *mm_memalign(size_t align, size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern int mm_trim(size_t pad);
+extern size_t mm_usable_size(void *ptr);
+
+/* checks the heap (every arena, nothing else must be running): 1 if it is consistent, 0 otherwise */
+extern int mm_check(void);
+
+/* index and placement policy the package was built with */
+extern const char *mm_placement;
+
+/* NUMA nodes whose heaps mm_stats reports apart */
+#define MM_MAX_NODES 8
+
+/* 
+ * Counters kept up to date by the package when built with MM_STATS,
+ * summed over the arenas. Sizes are in bytes, headers included.
+ */
+struct mm_stats {
+    size_t heap_bytes;            /* size of the heaps */
+    size_t mapped_bytes;          /* mapped for huge blocks */
+    size_t live_bytes;            /* in allocated blocks of the heaps (slabs, cached and pending blocks too) */
+    size_t free_bytes;            /* in free blocks */
+    size_t free_blocks;           /* number of free blocks */
+    size_t largest_free_block;    /* size of the largest free block */
+    double avg_visited;           /* free blocks looked at per malloc, on average */
+    unsigned long max_visited;    /* and at most */
+    unsigned long mallocs;        /* mallocs served by the heaps */
+    unsigned long splits;         /* free blocks split to serve a malloc or a realloc */
+    unsigned long coalesces;      /* free blocks merged with a neighbour */
+    unsigned long reallocs_in_place; /* reallocs done without a new block */
+    unsigned long realloc_copies; /* reallocs that had to move the payload to a new block */
+    unsigned long sbrk_calls;     /* calls to mem_sbrk or mem_seg_sbrk */
+    int nodes;                    /* NUMA nodes the heaps are spread over (1 without MEM_NUMA) */
+    size_t node_heap_bytes[MM_MAX_NODES]; /* size of the heaps of the arenas of each node */
+    size_t node_live_bytes[MM_MAX_NODES]; /* and in their allocated blocks */
+};
+
+/* fills *stats and returns 0, or returns -1 if the package was built without MM_STATS */
+extern int mm_stats(struct mm_stats *stats);
 
 
 /* 
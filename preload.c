@@ -0,0 +1,577 @@
+/*
+ * preload.c - Runs mm.c as the allocator of a real process
+ *
+ *     Built into libmm.so (make libmm.so) with mm.c and memlib.c, it
+ *     exports malloc, free, realloc, calloc, posix_memalign,
+ *     aligned_alloc, memalign, valloc, pvalloc and malloc_usable_size
+ *     on top of the mm_ functions:
+ *
+ *         LD_PRELOAD=./libmm.so ls -l
+ *
+ *     The heap is the mmap-backed memlib heap (MEM_MMAP), with a
+ *     ceiling of PRELOAD_MAX_HEAP unless MEM_MAX_HEAP is set. Without
+ *     MM_ARENAS, mm.c is not thread safe and the calls are serialized
+ *     with a lock. Pointers that are neither in the heap nor in a
+ *     mapping of memlib (allocated before the library was loaded) are
+ *     never freed.
+ *
+ *     With MM_RECORD=<file> in the environment, every call is also
+ *     recorded, and the trace is written to <file> in the mdriver
+ *     format when the process exits. Each thread fills a buffer of its
+ *     own, which is appended to <file>.raw when full; at exit, the raw
+ *     records are sorted and converted. To know the id of a block
+ *     without any shared table, a recorded block has a prefix_t before
+ *     it. Requests of 0 bytes are recorded as 1 byte, and alignments
+ *     are not recorded. A forked child stops recording, but a program
+ *     it runs records its own trace: each process has a raw file of
+ *     its own (<file>.<pid>.raw), and a %p in <file> is replaced by
+ *     the process id, or the last one to exit writes the trace.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "config.h"
+
+#if !MEM_MMAP
+#error "libmm.so needs MEM_MMAP: memlib would allocate the heap with malloc"
+#endif
+#if !MM_SILENT
+#error "libmm.so needs MM_SILENT: mm.c and memlib.c would print into the program's output"
+#endif
+
+/* default heap ceiling, only reserved */
+#define PRELOAD_MAX_HEAP ((size_t)16 << 30)
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static int ready;               /* set once mm_init succeeded */
+
+#if !MM_ARENAS
+/* recursive: memlib prints its fatal errors with stdio, which may call malloc */
+static pthread_mutex_t mm_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+#define LOCK()   pthread_mutex_lock(&mm_lock)
+#define UNLOCK() pthread_mutex_unlock(&mm_lock)
+
+/* the lock is held across a fork, and made anew in the child which has another thread id */
+static void fork_prepare(void)
+{
+    LOCK();
+}
+
+static void fork_parent(void)
+{
+    UNLOCK();
+}
+
+static void fork_child(void)
+{
+    pthread_mutex_t lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+    mm_lock = lock;
+}
+#else
+#define LOCK()
+#define UNLOCK()
+#endif
+
+/* Recorded requests, in the raw file */
+enum {REC_ALLOC, REC_FREE, REC_REALLOC};
+
+typedef struct {
+    unsigned long seq;      /* position of the request among all the threads */
+    unsigned long id;       /* block id */
+    size_t size;
+    int type;
+} record_t;
+
+/* What a recorded block has before it */
+typedef struct {
+    unsigned long id;
+    size_t offset;          /* from the block returned by mm.c to the payload */
+} prefix_t;
+
+#define REC_BUF_RECORDS 4096
+
+/* A buffer of one thread, linked with the others so that they can all be flushed at exit */
+typedef struct rec_buf {
+    record_t records[REC_BUF_RECORDS];
+    int count;
+    struct rec_buf *next;
+} rec_buf_t;
+
+static int prefixed;            /* set if the blocks have a prefix_t, from the first call on */
+static int recording;           /* set while requests are recorded, until exit */
+static char rec_path[4096];     /* the trace, the raw records go to rec_path.<pid>.raw */
+static int rec_fd = -1;
+static pid_t rec_pid;           /* the process recording, which writes the trace */
+static unsigned long rec_seq;   /* next request position */
+static unsigned long rec_ids;   /* next block id */
+static rec_buf_t *rec_bufs;     /* all the buffers, pushed with a CAS */
+static pthread_key_t rec_key;
+static __thread rec_buf_t *rec_buf;
+
+static void die(const char *msg)
+{
+    write(2, msg, strlen(msg));
+    abort();
+}
+
+/* the raw file of this process */
+static void rec_raw_path(char *raw_path, size_t size)
+{
+    snprintf(raw_path, size, "%s.%ld.raw", rec_path, (long)rec_pid);
+}
+
+/*
+ * rec_open - Creates the raw file on the first flush, so that a process
+ *     running another program before that leaves none behind
+ */
+static void rec_open(void)
+{
+    static pthread_mutex_t open_lock = PTHREAD_MUTEX_INITIALIZER;
+    char raw_path[sizeof(rec_path) + 32];
+    int fd;
+
+    pthread_mutex_lock(&open_lock);
+    if (__atomic_load_n(&rec_fd, __ATOMIC_RELAXED) < 0) {
+	rec_raw_path(raw_path, sizeof(raw_path));
+	fd = open(raw_path, O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+	if (fd < 0)
+	    die("libmm: can't create the raw trace\n");
+	__atomic_store_n(&rec_fd, fd, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&open_lock);
+}
+
+/*
+ * rec_flush - Appends the records of a buffer to the raw file, and
+ *     empties it
+ */
+static void rec_flush(rec_buf_t *buf)
+{
+    size_t len = buf->count * sizeof(record_t);
+    char *p = (char *)buf->records;
+    ssize_t n;
+
+    if (__atomic_load_n(&rec_fd, __ATOMIC_ACQUIRE) < 0)
+	rec_open();
+    while (len > 0) {
+	if ((n = write(rec_fd, p, len)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    die("libmm: can't write the raw trace\n");
+	}
+	p += n;
+	len -= n;
+    }
+    buf->count = 0;
+}
+
+/* a forked child has the buffers and the raw file of its parent, and leaves them alone */
+static void rec_fork_child(void)
+{
+    recording = 0;
+    if (rec_fd >= 0)
+	close(rec_fd);
+    rec_fd = -1;
+}
+
+/* flushes the buffer of a thread that exits */
+static void rec_thread_exit(void *buf)
+{
+    if (recording)
+	rec_flush((rec_buf_t *)buf);
+}
+
+/*
+ * rec_add - Records a request of the calling thread
+ */
+static void rec_add(int type, unsigned long id, size_t size)
+{
+    rec_buf_t *buf = rec_buf;
+    record_t *r;
+
+    if (!recording)
+	return;
+    if (buf == NULL) {
+	/* mapped, not allocated: the allocator is the one being recorded */
+	buf = mmap(NULL, sizeof(rec_buf_t), PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buf == MAP_FAILED)
+	    die("libmm: can't map a record buffer\n");
+	do
+	    buf->next = __atomic_load_n(&rec_bufs, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&rec_bufs, &buf->next, buf, 0,
+					    __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	rec_buf = buf;
+	pthread_setspecific(rec_key, buf);
+    }
+    r = &buf->records[buf->count];
+    r->seq = __atomic_fetch_add(&rec_seq, 1, __ATOMIC_RELAXED);
+    r->id = id;
+    r->size = (size == 0) ? 1 : size;
+    r->type = type;
+    if (++buf->count == REC_BUF_RECORDS)
+	rec_flush(buf);
+}
+
+static int cmp_seq(const void *a, const void *b)
+{
+    unsigned long sa = ((const record_t *)a)->seq;
+    unsigned long sb = ((const record_t *)b)->seq;
+    return (sa > sb) - (sa < sb);
+}
+
+/*
+ * out_printf - Appends to the trace through a static buffer, without
+ *     stdio (and its mallocs)
+ */
+static char out_buf[1 << 16];
+static size_t out_len;
+static int out_fd;
+
+static void out_flush(void)
+{
+    if (write(out_fd, out_buf, out_len) != (ssize_t)out_len)
+	die("libmm: can't write the trace\n");
+    out_len = 0;
+}
+
+static void out_printf(const char *fmt, unsigned long a, unsigned long b)
+{
+    if (out_len > sizeof(out_buf) - 64)
+	out_flush();
+    out_len += snprintf(out_buf + out_len, sizeof(out_buf) - out_len, fmt, a, b);
+}
+
+/*
+ * rec_finish - At exit, flushes all the buffers, sorts the raw records
+ *     and writes the trace. The requests of a block seen out of order
+ *     (by threads still running) are dropped, so that mdriver can
+ *     replay the trace.
+ */
+static void rec_finish(void)
+{
+    char raw_path[sizeof(rec_path) + 32];
+    rec_buf_t *buf;
+    struct stat st;
+    record_t *r;
+    unsigned char *live;
+    size_t n, i, ops = 0, ids = 0, *sizes, cur = 0, peak = 0;
+
+    if (!recording || getpid() != rec_pid)
+	return;
+    recording = 0;
+    for (buf = rec_bufs; buf != NULL; buf = buf->next)
+	rec_flush(buf);
+    if (rec_fd < 0)
+	rec_open();
+
+    if (fstat(rec_fd, &st) < 0)
+	die("libmm: can't read the raw trace\n");
+    n = st.st_size / sizeof(record_t);
+    r = mmap(NULL, n * sizeof(record_t) + 1, PROT_READ | PROT_WRITE, MAP_SHARED, rec_fd, 0);
+    live = mmap(NULL, rec_ids + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    sizes = mmap(NULL, (rec_ids + 1) * sizeof(size_t), PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (r == MAP_FAILED || live == MAP_FAILED || sizes == MAP_FAILED)
+	die("libmm: can't map the raw trace\n");
+    qsort(r, n, sizeof(record_t), cmp_seq);
+
+    /* keep the requests in order only, and find the peak of the live bytes */
+    for (i = 0; i < n; i++) {
+	if ((r[i].type == REC_ALLOC) == live[r[i].id]) {
+	    r[i].type = -1;
+	    continue;
+	}
+	cur -= sizes[r[i].id];
+	live[r[i].id] = (r[i].type != REC_FREE);
+	sizes[r[i].id] = live[r[i].id] ? r[i].size : 0;
+	cur += sizes[r[i].id];
+	if (cur > peak)
+	    peak = cur;
+	if (r[i].id >= ids)
+	    ids = r[i].id + 1;
+	ops++;
+    }
+
+    if ((out_fd = open(rec_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+	die("libmm: can't create the trace\n");
+    out_printf("%lu\n%lu\n", peak, ids);
+    out_printf("%lu\n%lu\n", ops, 1);
+    for (i = 0; i < n; i++) {
+	if (r[i].type == REC_ALLOC)
+	    out_printf("a %lu %lu\n", r[i].id, r[i].size);
+	else if (r[i].type == REC_REALLOC)
+	    out_printf("r %lu %lu\n", r[i].id, r[i].size);
+	else if (r[i].type == REC_FREE)
+	    out_printf("f %lu\n", r[i].id, 0);
+    }
+    out_flush();
+    close(out_fd);
+
+    munmap(r, n * sizeof(record_t) + 1);
+    close(rec_fd);
+    rec_raw_path(raw_path, sizeof(raw_path));
+    unlink(raw_path);
+}
+
+/*
+ * rec_set_path - Sets rec_path to path, with every %p replaced by the
+ *     process id. Returns 0 if it is too long.
+ */
+static int rec_set_path(const char *path)
+{
+    size_t len = 0;
+
+    for (; *path != '\0'; path++) {
+	if (path[0] == '%' && path[1] == 'p') {
+	    len += snprintf(rec_path + len, sizeof(rec_path) - len, "%ld", (long)rec_pid);
+	    path++;
+	}
+	else if (len < sizeof(rec_path))
+	    rec_path[len++] = *path;
+	if (len >= sizeof(rec_path))
+	    return 0;
+    }
+    rec_path[len] = '\0';
+    return 1;
+}
+
+/*
+ * preload_init - Initializes memlib and mm.c on the first call, and
+ *     starts recording if asked to
+ */
+static void preload_init(void)
+{
+    char *path = getenv("MM_RECORD");
+
+    if (getenv("MEM_MAX_HEAP") == NULL)
+	mem_set_max_heap(PRELOAD_MAX_HEAP);
+    mem_init();
+    if (mm_init() < 0)
+	die("libmm: mm_init failed, is the heap ceiling too large?\n");
+    ready = 1;
+#if !MM_ARENAS
+    pthread_atfork(fork_prepare, fork_parent, fork_child);
+#endif
+
+    rec_pid = getpid();
+    if (path != NULL && *path != '\0' && rec_set_path(path)) {
+	pthread_key_create(&rec_key, rec_thread_exit);
+	pthread_atfork(NULL, NULL, rec_fork_child);
+	atexit(rec_finish);
+	prefixed = recording = 1;
+    }
+}
+
+#define INIT() (ready ? (void)0 : (void)pthread_once(&init_once, preload_init))
+
+/* returns 1 if ptr was returned by mm.c */
+static int is_ours(void *ptr)
+{
+    char *lo = mem_heap_lo();
+
+    return ready && (((char *)ptr >= lo && (char *)ptr < lo + mem_max_heap()) ||
+		     mem_is_mapped(ptr, ptr));
+}
+
+/*
+ * rec_prefix, rec_base - Return the prefix of a payload, and the block
+ *     mm.c returned for it
+ */
+static inline prefix_t *rec_prefix(void *ptr)
+{
+    return (prefix_t *)ptr - 1;
+}
+
+static inline void *rec_base(void *ptr)
+{
+    return (char *)ptr - rec_prefix(ptr)->offset;
+}
+
+/*
+ * rec_alloc - Allocates a block with a prefix, with its prefix_t before the
+ *     payload (aligned to align if larger than ALIGNMENT)
+ */
+static void *rec_alloc(size_t align, size_t size)
+{
+    size_t offset = (align > ALIGNMENT) ? align : sizeof(prefix_t);
+    char *base;
+    prefix_t *prefix;
+
+    if (size > (size_t)-1 - offset)
+	return NULL;
+    LOCK();
+    base = (align > ALIGNMENT) ? mm_memalign(align, size + offset) :
+	mm_malloc(size + offset);
+    UNLOCK();
+    if (base == NULL)
+	return NULL;
+    prefix = (prefix_t *)(base + offset) - 1;
+    prefix->id = __atomic_fetch_add(&rec_ids, 1, __ATOMIC_RELAXED);
+    prefix->offset = offset;
+    rec_add(REC_ALLOC, prefix->id, size);
+    return base + offset;
+}
+
+static void *do_malloc(size_t align, size_t size)
+{
+    void *ptr;
+
+    INIT();
+    if (prefixed)
+	ptr = rec_alloc(align, size);
+    else {
+	LOCK();
+	ptr = (align > ALIGNMENT) ? mm_memalign(align, size) : mm_malloc(size);
+	UNLOCK();
+    }
+    if (ptr == NULL)
+	errno = ENOMEM;
+    return ptr;
+}
+
+void *malloc(size_t size)
+{
+    return do_malloc(0, size);
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL || !is_ours(ptr))
+	return;
+    if (prefixed) {
+	rec_add(REC_FREE, rec_prefix(ptr)->id, 0);
+	ptr = rec_base(ptr);
+    }
+    LOCK();
+    mm_free(ptr);
+    UNLOCK();
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    prefix_t prefix;
+    char *base;
+
+    if (ptr == NULL)
+	return malloc(size);
+    if (!is_ours(ptr))
+	die("libmm: realloc of a block that is not ours\n");
+    if (size == 0) {
+	free(ptr);
+	return NULL;
+    }
+    if (!prefixed) {
+	LOCK();
+	ptr = mm_realloc(ptr, size);
+	UNLOCK();
+	if (ptr == NULL)
+	    errno = ENOMEM;
+	return ptr;
+    }
+
+    /* the payload stays at the same offset in the new block, then moves after the prefix */
+    prefix = *rec_prefix(ptr);
+    if (size > (size_t)-1 - prefix.offset) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    LOCK();
+    base = mm_realloc(rec_base(ptr), size + prefix.offset);
+    UNLOCK();
+    if (base == NULL) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    if (prefix.offset != sizeof(prefix_t)) {
+	memmove(base + sizeof(prefix_t), base + prefix.offset, size);
+	prefix.offset = sizeof(prefix_t);
+    }
+    *rec_prefix(base + prefix.offset) = prefix;
+    rec_add(REC_REALLOC, prefix.id, size);
+    return base + prefix.offset;
+}
+
+void *calloc(size_t count, size_t size)
+{
+    void *ptr;
+
+    if (size != 0 && count > (size_t)-1 / size) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    /* not malloc, which gcc would turn with the memset into a call to calloc */
+    if ((ptr = do_malloc(0, count * size)) != NULL)
+	memset(ptr, 0, count * size);
+    return ptr;
+}
+
+int posix_memalign(void **ptr, size_t align, size_t size)
+{
+    void *p;
+
+    if (align < sizeof(void *) || (align & (align - 1)) != 0)
+	return EINVAL;
+    if ((p = do_malloc(align, size)) == NULL)
+	return ENOMEM;
+    *ptr = p;
+    return 0;
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+    if (align == 0 || (align & (align - 1)) != 0) {
+	errno = EINVAL;
+	return NULL;
+    }
+    return do_malloc(align, size);
+}
+
+void *memalign(size_t align, size_t size)
+{
+    return aligned_alloc(align, size);
+}
+
+void *valloc(size_t size)
+{
+    return do_malloc(mem_pagesize(), size);
+}
+
+void *pvalloc(size_t size)
+{
+    size_t page = mem_pagesize();
+
+    if (size > (size_t)-1 - page) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    /* a whole number of pages, at least one */
+    return do_malloc(page, (size == 0) ? page : (size + page - 1) & ~(page - 1));
+}
+
+/* the prefix of a recorded block is not part of the payload; with
+   MM_REALLOC_SLACK, mm_usable_size reads the tables of the heap */
+size_t malloc_usable_size(void *ptr)
+{
+    size_t size;
+
+    if (ptr == NULL || !is_ours(ptr))
+	return 0;
+    LOCK();
+    if (prefixed)
+	size = mm_usable_size(rec_base(ptr)) - rec_prefix(ptr)->offset;
+    else
+	size = mm_usable_size(ptr);
+    UNLOCK();
+    return size;
+}
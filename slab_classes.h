@@ -0,0 +1,13 @@
+/*
+ * Slab size classes, generated by mdriver -S 8,64 from the requests of
+ *     short1-bal.rep
+ *     short2-bal.rep
+ * 2 requests of at most 64 bytes, 0.00% of their bytes wasted.
+ * slab_class_of gives the class of a request from its size rounded up
+ * to the alignment.
+ */
+#define SLAB_MAX_OBJECT     64
+#define SLAB_CLASSES        8
+
+static const size_t slab_class_size[SLAB_CLASSES] = {8, 16, 24, 32, 40, 48, 56, 64};
+static const unsigned char slab_class_of[SLAB_MAX_OBJECT / ALIGNMENT + 1] = {0, 0, 1, 2, 3, 4, 5, 6, 7};
@@ -0,0 +1,406 @@
+/*
+ * tracegen.c - Synthetic trace generator for the Malloc Lab driver
+ *
+ * Writes a balanced trace (every block is freed by the end) in the
+ * mdriver text format. The trace is made of one or more phases, each
+ * with its own size distribution: blocks get a size from the
+ * distribution of the current phase and a lifetime (in requests) from
+ * the lifetime distribution, the number of live blocks being capped.
+ * Live blocks are reallocated at random following a growth pattern.
+ * At every phase change, part of the live blocks is freed at once.
+ *
+ * Convert the output with "mdriver -f <file> -B <binary file>" to
+ * replay large traces without parsing them.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#define MAX_PHASES 16
+
+/* A distribution of sizes or lifetimes, given as kind:parameters */
+typedef struct {
+    enum {FIXED, UNIFORM, LOGNORMAL, BIMODAL, POW2, EXP} kind;
+    double a, b, p;
+} dist_t;
+
+/* A block id and when it must be freed, in the heap of live blocks */
+typedef struct {
+    double death;   /* request number at which the block is freed */
+    int id;
+} live_t;
+
+/* Types of requests, as in mdriver */
+enum {ALLOC, FREE, REALLOC};
+
+typedef struct {
+    int type;
+    int id;
+    int size;
+} op_t;
+
+/* Parameters of the trace, from the command line */
+static long num_ops = 100000;       /* number of requests */
+static int max_live = 1000;         /* number of live blocks at most */
+static dist_t sizes[MAX_PHASES];    /* size distribution of each phase */
+static int num_phases = 0;
+static dist_t lifetimes = {EXP, 1000, 0, 0};
+static double realloc_prob = 0;     /* probability of a realloc per request */
+static enum {GEOMETRIC, LINEAR, RESAMPLE} growth = GEOMETRIC;
+static double growth_arg = 2;       /* factor or increment of the growth */
+static double phase_kill = 0.5;     /* fraction of live blocks freed at a phase change */
+static int max_size = 1 << 24;      /* sizes are capped to this */
+
+/* The trace being generated */
+static op_t *ops;
+static long ops_count = 0, ops_room = 0;
+static int *block_sizes;            /* current size of every block id */
+static int num_ids = 0, ids_room = 0;
+
+/* The live blocks, in a binary heap by death... */
+static live_t *heap;
+static int heap_count = 0;
+/* ... and their ids in an array with their positions, to pick one at random */
+static int *live_ids;
+static int *live_pos;               /* position of each id in live_ids, -1 if dead */
+static int live_count = 0;
+
+static long cur_bytes = 0, peak_bytes = 0;
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: tracegen [-h] [-n <ops>] [-L <live>] [-s <size dist>]... [-l <lifetime dist>]\n");
+    fprintf(stderr, "                [-r <realloc prob>] [-g <growth>] [-k <fraction>] [-m <max size>]\n");
+    fprintf(stderr, "                [-S <seed>] [-o <file>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-n <ops>      Number of requests (default 100000).\n");
+    fprintf(stderr, "\t-L <live>     Blocks live at the same time at most (default 1000).\n");
+    fprintf(stderr, "\t-s <dist>     Size distribution of the next phase, one of fixed:n, uniform:a-b,\n");
+    fprintf(stderr, "\t              lognormal:median,sigma, bimodal:a,b,p (a with probability p) or\n");
+    fprintf(stderr, "\t              pow2:a-b (powers of 2 in a-b). Repeat for phase changes (default uniform:1-256).\n");
+    fprintf(stderr, "\t-l <dist>     Lifetime in requests: fixed:n, uniform:a-b or exp:mean (default exp:1000).\n");
+    fprintf(stderr, "\t-r <prob>     Probability of a realloc of a live block per request (default 0).\n");
+    fprintf(stderr, "\t-g <growth>   Realloc sizes: geometric:factor, linear:bytes or resample (default geometric:2).\n");
+    fprintf(stderr, "\t-k <fraction> Fraction of the live blocks freed at a phase change (default 0.5).\n");
+    fprintf(stderr, "\t-m <size>     Largest size of a request (default 16777216).\n");
+    fprintf(stderr, "\t-S <seed>     Seed of the random generator (default 1).\n");
+    fprintf(stderr, "\t-o <file>     Write the trace to <file> instead of stdout.\n");
+}
+
+static void die(char *msg, char *arg)
+{
+    fprintf(stderr, "tracegen: %s%s\n", msg, arg);
+    exit(1);
+}
+
+/*
+ * parse_dist - Parses a distribution given as kind:parameters
+ */
+static dist_t parse_dist(char *arg)
+{
+    dist_t d = {FIXED, 0, 0, 0};
+    char *params = strchr(arg, ':');
+    int n = 0;
+
+    if (params != NULL)
+	params++;
+    if (!strncmp(arg, "fixed:", 6)) {
+	d.kind = FIXED;
+	n = sscanf(params, "%lf", &d.a) == 1;
+    } else if (!strncmp(arg, "uniform:", 8)) {
+	d.kind = UNIFORM;
+	n = sscanf(params, "%lf-%lf", &d.a, &d.b) == 2 && d.a <= d.b;
+    } else if (!strncmp(arg, "lognormal:", 10)) {
+	d.kind = LOGNORMAL;
+	n = sscanf(params, "%lf,%lf", &d.a, &d.b) == 2 && d.a > 0;
+    } else if (!strncmp(arg, "bimodal:", 8)) {
+	d.kind = BIMODAL;
+	n = sscanf(params, "%lf,%lf,%lf", &d.a, &d.b, &d.p) == 3;
+    } else if (!strncmp(arg, "pow2:", 5)) {
+	d.kind = POW2;
+	/* the range must hold a power of 2 */
+	n = sscanf(params, "%lf-%lf", &d.a, &d.b) == 2 && d.a >= 1 && d.a <= d.b &&
+	    ceil(log2(d.a)) <= floor(log2(d.b));
+    } else if (!strncmp(arg, "exp:", 4)) {
+	d.kind = EXP;
+	n = sscanf(params, "%lf", &d.a) == 1;
+    }
+    if (!n)
+	die("bad distribution ", arg);
+    return d;
+}
+
+/*
+ * sample - Draws a value from a distribution
+ */
+static double sample(dist_t *d)
+{
+    double u, v;
+
+    switch (d->kind) {
+    case FIXED:
+	return d->a;
+    case UNIFORM:
+	return floor(d->a + drand48() * (d->b - d->a + 1));
+    case LOGNORMAL: /* Box-Muller */
+	u = 1 - drand48();
+	v = drand48();
+	return d->a * exp(d->b * sqrt(-2 * log(u)) * cos(2 * M_PI * v));
+    case BIMODAL:
+	return (drand48() < d->p) ? d->a : d->b;
+    case POW2: /* every power of 2 of the range equally likely */
+	u = ceil(log2(d->a));
+	return ldexp(1, (int)(u + floor(drand48() * (floor(log2(d->b)) - u + 1))));
+    case EXP:
+	return -d->a * log(1 - drand48());
+    }
+    return 0;
+}
+
+/*
+ * clamp_size - Rounds a sampled size to a valid request size
+ */
+static int clamp_size(double size)
+{
+    if (size < 1)
+	return 1;
+    if (size > max_size)
+	return max_size;
+    return (int)size;
+}
+
+static void emit(int type, int id, int size)
+{
+    if (ops_count == ops_room) {
+	ops_room = ops_room ? 2 * ops_room : 1 << 16;
+	if ((ops = realloc(ops, ops_room * sizeof(op_t))) == NULL)
+	    die("out of memory", "");
+    }
+    ops[ops_count].type = type;
+    ops[ops_count].id = id;
+    ops[ops_count].size = size;
+    ops_count++;
+}
+
+/* The heap of live blocks, smallest death first */
+static void heap_swap(int i, int j)
+{
+    live_t t = heap[i];
+    heap[i] = heap[j];
+    heap[j] = t;
+}
+
+static void heap_push(int id, double death)
+{
+    int i = heap_count++;
+
+    heap[i].id = id;
+    heap[i].death = death;
+    while (i > 0 && heap[(i - 1) / 2].death > heap[i].death) {
+	heap_swap(i, (i - 1) / 2);
+	i = (i - 1) / 2;
+    }
+}
+
+static int heap_pop(void)
+{
+    int id = heap[0].id;
+    int i = 0, child;
+
+    heap[0] = heap[--heap_count];
+    while ((child = 2 * i + 1) < heap_count) {
+	if (child + 1 < heap_count && heap[child + 1].death < heap[child].death)
+	    child++;
+	if (heap[i].death <= heap[child].death)
+	    break;
+	heap_swap(i, child);
+	i = child;
+    }
+    return id;
+}
+
+/*
+ * alloc_block - Allocates a new block from the size distribution of the phase
+ */
+static void alloc_block(dist_t *size_dist)
+{
+    int id = num_ids++;
+    int size = clamp_size(sample(size_dist));
+
+    if (num_ids > ids_room) {
+	ids_room = ids_room ? 2 * ids_room : 1 << 16;
+	if ((block_sizes = realloc(block_sizes, ids_room * sizeof(int))) == NULL ||
+	    (live_pos = realloc(live_pos, ids_room * sizeof(int))) == NULL)
+	    die("out of memory", "");
+    }
+    block_sizes[id] = size;
+    live_pos[id] = live_count;
+    live_ids[live_count++] = id;
+    heap_push(id, ops_count + 1 + sample(&lifetimes));
+    cur_bytes += size;
+    if (cur_bytes > peak_bytes)
+	peak_bytes = cur_bytes;
+    emit(ALLOC, id, size);
+}
+
+/*
+ * free_block - Frees the live block that dies first
+ */
+static void free_block(void)
+{
+    int id = heap_pop();
+    int pos = live_pos[id];
+
+    live_ids[pos] = live_ids[--live_count];
+    live_pos[live_ids[pos]] = pos;
+    live_pos[id] = -1;
+    cur_bytes -= block_sizes[id];
+    emit(FREE, id, 0);
+}
+
+/*
+ * realloc_block - Reallocates a live block picked at random, following the growth pattern
+ */
+static void realloc_block(dist_t *size_dist)
+{
+    int id = live_ids[(int)(drand48() * live_count)];
+    int size;
+
+    switch (growth) {
+    case GEOMETRIC:
+	size = clamp_size(block_sizes[id] * growth_arg);
+	break;
+    case LINEAR:
+	size = clamp_size(block_sizes[id] + growth_arg);
+	break;
+    default:
+	size = clamp_size(sample(size_dist));
+    }
+    cur_bytes += size - block_sizes[id];
+    if (cur_bytes > peak_bytes)
+	peak_bytes = cur_bytes;
+    block_sizes[id] = size;
+    emit(REALLOC, id, size);
+}
+
+int main(int argc, char **argv)
+{
+    char c;
+    char *outname = NULL;
+    FILE *out = stdout;
+    long seed = 1;
+    long i, phase_end;
+    int phase, kill;
+
+    while ((c = getopt(argc, argv, "n:L:s:l:r:g:k:m:S:o:h")) != EOF) {
+	switch (c) {
+	case 'n':
+	    num_ops = atol(optarg);
+	    break;
+	case 'L':
+	    max_live = atoi(optarg);
+	    break;
+	case 's':
+	    if (num_phases == MAX_PHASES)
+		die("too many phases", "");
+	    sizes[num_phases++] = parse_dist(optarg);
+	    break;
+	case 'l':
+	    lifetimes = parse_dist(optarg);
+	    break;
+	case 'r':
+	    realloc_prob = atof(optarg);
+	    break;
+	case 'g':
+	    if (!strncmp(optarg, "geometric:", 10))
+		growth = GEOMETRIC;
+	    else if (!strncmp(optarg, "linear:", 7))
+		growth = LINEAR;
+	    else if (!strcmp(optarg, "resample"))
+		growth = RESAMPLE;
+	    else
+		die("bad growth ", optarg);
+	    if (growth != RESAMPLE)
+		growth_arg = atof(strchr(optarg, ':') + 1);
+	    break;
+	case 'k':
+	    phase_kill = atof(optarg);
+	    break;
+	case 'm':
+	    max_size = atoi(optarg);
+	    break;
+	case 'S':
+	    seed = atol(optarg);
+	    break;
+	case 'o':
+	    outname = optarg;
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (num_phases == 0)
+	sizes[num_phases++] = parse_dist("uniform:1-256");
+    if (num_ops < 2 || max_live < 1 || max_size < 1)
+	die("bad number of requests, live blocks or max size", "");
+    srand48(seed);
+
+    if ((heap = malloc(max_live * sizeof(live_t))) == NULL ||
+	(live_ids = malloc(max_live * sizeof(int))) == NULL)
+	die("out of memory", "");
+
+    /*
+     * Every request frees the blocks past their lifetime, or reallocs
+     * a live block, or allocates a new one if the live set is not full
+     * (otherwise the block dying first is freed early). We stop when
+     * freeing all the live blocks makes num_ops requests: a block
+     * allocated takes two, so the last request of a phase is a realloc.
+     */
+    for (phase = 0; phase < num_phases; phase++) {
+	if (phase > 0) {
+	    kill = (int)(phase_kill * live_count);
+	    while (kill-- > 0)
+		free_block();
+	}
+	phase_end = num_ops * (phase + 1) / num_phases;
+	while (ops_count + live_count < phase_end) {
+	    if (heap_count > 0 && heap[0].death <= ops_count)
+		free_block();
+	    else if (live_count > 0 && (drand48() < realloc_prob ||
+					ops_count + live_count + 1 == phase_end))
+		realloc_block(&sizes[phase]);
+	    else if (live_count < max_live)
+		alloc_block(&sizes[phase]);
+	    else
+		free_block();
+	}
+    }
+    while (live_count > 0)
+	free_block();
+
+    /* Write the trace, in the format read by mdriver */
+    if (outname != NULL && (out = fopen(outname, "w")) == NULL)
+	die("could not open ", outname);
+    fprintf(out, "%ld\n%d\n%ld\n1\n", peak_bytes, num_ids, ops_count);
+    for (i = 0; i < ops_count; i++) {
+	switch (ops[i].type) {
+	case ALLOC:
+	    fprintf(out, "a %d %d\n", ops[i].id, ops[i].size);
+	    break;
+	case REALLOC:
+	    fprintf(out, "r %d %d\n", ops[i].id, ops[i].size);
+	    break;
+	default:
+	    fprintf(out, "f %d\n", ops[i].id);
+	}
+    }
+    if (out != stdout && fclose(out) != 0)
+	die("could not write ", outname);
+    return 0;
+}